@@ -32,29 +32,107 @@
 #include "vmwgfx_compat.h"
 
 #if defined(CONFIG_X86)
+
+/*
+ * From this many pages on, a wbinvd on all CPUs is cheaper than flushing
+ * every cache line of the range. Computed on first use.
+ */
+static unsigned long drm_clflush_wbinvd_pages;
+
+/* -1: not yet probed, 0: clflush only, 1: clflushopt available */
+static int drm_has_clflushopt = -1;
+
+static bool drm_cpu_has_clflushopt(void)
+{
+	if (unlikely(drm_has_clflushopt < 0)) {
+#ifdef X86_FEATURE_CLFLUSHOPT
+		drm_has_clflushopt = boot_cpu_has(X86_FEATURE_CLFLUSHOPT);
+#else
+		unsigned int eax, ebx, ecx, edx;
+
+		drm_has_clflushopt = 0;
+		if (boot_cpu_data.cpuid_level >= 7) {
+			cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+			drm_has_clflushopt = (ebx & (1 << 23)) != 0;
+		}
+#endif
+	}
+
+	return drm_has_clflushopt;
+}
+
+/*
+ * Whether to flush @num_pages with wbinvd rather than clflush. The
+ * standalone module can't issue the IPI, and in a virtual machine
+ * wbinvd is trapped, so only do this for ranges twice the size of the
+ * last level cache or larger.
+ */
+static bool drm_cache_use_wbinvd(unsigned long num_pages)
+{
+#ifndef VMWGFX_STANDALONE
+	if (unlikely(drm_clflush_wbinvd_pages == 0)) {
+		unsigned long bytes = 8UL << 20;
+
+		/* x86_cache_size is in kB and is negative if unknown. */
+		if (boot_cpu_data.x86_cache_size > 0)
+			bytes = (unsigned long) boot_cpu_data.x86_cache_size
+				<< 11;
+		drm_clflush_wbinvd_pages = max(bytes >> PAGE_SHIFT, 1UL);
+	}
+
+	return num_pages >= drm_clflush_wbinvd_pages;
+#else
+	return false;
+#endif
+}
+
+/*
+ * clflushopt is encoded as clflush with an operand size prefix. Unlike
+ * clflush, it is only ordered by fences, so callers must fence after
+ * the flush loop.
+ */
+static inline void drm_clflushopt(volatile void *p)
+{
+	asm volatile(".byte 0x66; clflush %0" : "+m" (*(volatile char *)p));
+}
+
+static void drm_clflush_range(void *addr, unsigned long length, bool opt)
+{
+	const unsigned long size = boot_cpu_data.x86_clflush_size;
+	char *p = (char *) ((unsigned long) addr & ~(size - 1));
+	char *end = (char *) addr + length;
+
+	if (opt) {
+		for (; p < end; p += size)
+			drm_clflushopt(p);
+	} else {
+		for (; p < end; p += size)
+			clflush(p);
+	}
+}
+
 static void
-drm_clflush_page(struct page *page)
+drm_clflush_page(struct page *page, bool opt)
 {
 	uint8_t *page_virtual;
-	unsigned int i;
 
 	if (unlikely(page == NULL))
 		return;
 
 	page_virtual = kmap_atomic(page, KM_USER0);
-	for (i = 0; i < PAGE_SIZE; i += boot_cpu_data.x86_clflush_size)
-		clflush(page_virtual + i);
+	drm_clflush_range(page_virtual, PAGE_SIZE, opt);
 	kunmap_atomic(page_virtual, KM_USER0);
 }
 
 static void drm_cache_flush_clflush(struct page *pages[],
 				    unsigned long num_pages)
 {
+	bool opt = drm_cpu_has_clflushopt();
 	unsigned long i;
 
 	mb();
 	for (i = 0; i < num_pages; i++)
-		drm_clflush_page(*pages++);
+		drm_clflush_page(*pages++, opt);
 	mb();
 }
 
@@ -72,7 +150,7 @@ drm_clflush_pages(struct page *pages[], unsigned long num_pages)
 {
 
 #if defined(CONFIG_X86)
-	if (cpu_has_clflush) {
+	if (cpu_has_clflush && !drm_cache_use_wbinvd(num_pages)) {
 		drm_cache_flush_clflush(pages, num_pages);
 		return;
 	}
@@ -62,6 +62,11 @@
 #define DRM_IRQ_ARGS		int irq, void *arg, struct pt_regs *regs
 #endif
 
+/* threaded irq handlers */
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,30))
+#define DRM_HAS_THREADED_IRQ
+#endif
+
 #ifndef list_for_each_safe
 #define list_for_each_safe(pos, n, head)				\
 	for (pos = (head)->next, n = pos->next; pos != (head);		\
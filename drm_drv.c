@@ -133,6 +133,7 @@ static struct drm_ioctl_desc drm_ioctls[] = {
 	DRM_IOCTL_DEF(DRM_IOCTL_MODE_GETFB, drm_mode_getfb, DRM_MASTER|DRM_CONTROL_ALLOW),
 	DRM_IOCTL_DEF(DRM_IOCTL_MODE_ADDFB, drm_mode_addfb, DRM_MASTER|DRM_CONTROL_ALLOW),
 	DRM_IOCTL_DEF(DRM_IOCTL_MODE_RMFB, drm_mode_rmfb, DRM_MASTER|DRM_CONTROL_ALLOW),
+	DRM_IOCTL_DEF(DRM_IOCTL_MODE_PAGE_FLIP, drm_mode_page_flip_ioctl, DRM_MASTER|DRM_CONTROL_ALLOW),
 	DRM_IOCTL_DEF(DRM_IOCTL_MODE_DIRTYFB, drm_mode_dirtyfb_ioctl, DRM_MASTER|DRM_CONTROL_ALLOW)
 };
 
@@ -421,6 +422,42 @@ static int drm_version(struct drm_device *dev, void *data,
 	return 0;
 }
 
+/**
+ * Number of IOCTLs currently executing on the device.
+ *
+ * \param dev DRM device.
+ * \return sum of the per-cpu pending counts.
+ */
+long drm_ioctl_pending(struct drm_device *dev)
+{
+	long pending = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		pending += per_cpu_ptr(dev->ioctl_pcpu, cpu)->pending;
+
+	return pending;
+}
+EXPORT_SYMBOL(drm_ioctl_pending);
+
+/**
+ * Number of IOCTLs performed on the device since it was set up.
+ *
+ * \param dev DRM device.
+ * \return sum of the per-cpu IOCTL counts.
+ */
+unsigned long drm_ioctl_total(struct drm_device *dev)
+{
+	unsigned long count = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		count += per_cpu_ptr(dev->ioctl_pcpu, cpu)->count;
+
+	return count;
+}
+EXPORT_SYMBOL(drm_ioctl_total);
+
 /**
  * Called whenever a process performs an ioctl on /dev/drm.
  *
@@ -439,6 +476,7 @@ long drm_ioctl(struct file *filp,
 	struct drm_file *file_priv = filp->private_data;
 	struct drm_device *dev;
 	struct drm_ioctl_desc *ioctl;
+	struct drm_ioctl_pcpu *pcpu;
 	drm_ioctl_t *func;
 	unsigned int nr = DRM_IOCTL_NR(cmd);
 	int retcode = -EINVAL;
@@ -446,8 +484,10 @@ long drm_ioctl(struct file *filp,
 	char *kdata = NULL;
 
 	dev = file_priv->minor->dev;
-	atomic_inc(&dev->ioctl_count);
-	atomic_inc(&dev->counts[_DRM_STAT_IOCTLS]);
+	pcpu = per_cpu_ptr(dev->ioctl_pcpu, get_cpu());
+	pcpu->pending++;
+	pcpu->count++;
+	put_cpu();
 	++file_priv->ioctl_count;
 
 	DRM_DEBUG("pid=%d, cmd=0x%02x, nr=0x%02x, dev 0x%lx, auth=%d\n",
@@ -519,7 +559,9 @@ long drm_ioctl(struct file *filp,
       err_i1:
 	if (kdata != stack_kdata)
 		kfree(kdata);
-	atomic_dec(&dev->ioctl_count);
+	/* May well be another cpu than the one we entered on. */
+	per_cpu_ptr(dev->ioctl_pcpu, get_cpu())->pending--;
+	put_cpu();
 	if (retcode)
 		DRM_DEBUG("ret = %x\n", retcode);
 	return retcode;
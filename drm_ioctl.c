@@ -282,6 +282,8 @@ int drm_getstats(struct drm_device *dev, void *data,
 		if (dev->types[i] == _DRM_STAT_LOCK)
 			stats->data[i].value =
 			    (file_priv->master->lock.hw_lock ? file_priv->master->lock.hw_lock->lock : 0);
+		else if (dev->types[i] == _DRM_STAT_IOCTLS)
+			stats->data[i].value = drm_ioctl_total(dev);
 		else
 			stats->data[i].value = atomic_read(&dev->counts[i]);
 		stats->data[i].type = dev->types[i];
@@ -105,6 +105,7 @@ void drm_vblank_cleanup(struct drm_device *dev)
 
 	kfree(dev->vbl_queue);
 	kfree(dev->_vblank_count);
+	kfree(dev->_vblank_time);
 	kfree(dev->vblank_refcount);
 	kfree(dev->vblank_enabled);
 	kfree(dev->last_vblank);
@@ -121,6 +122,7 @@ int drm_vblank_init(struct drm_device *dev, int num_crtcs)
 	setup_timer(&dev->vblank_disable_timer, vblank_disable_fn,
 		    (unsigned long)dev);
 	spin_lock_init(&dev->vbl_lock);
+	spin_lock_init(&dev->vblank_time_lock);
 	dev->num_crtcs = num_crtcs;
 
 	dev->vbl_queue = kmalloc(sizeof(wait_queue_head_t) * num_crtcs,
@@ -132,6 +134,11 @@ int drm_vblank_init(struct drm_device *dev, int num_crtcs)
 	if (!dev->_vblank_count)
 		goto err;
 
+	dev->_vblank_time = kcalloc(num_crtcs, sizeof(struct timeval),
+				    GFP_KERNEL);
+	if (!dev->_vblank_time)
+		goto err;
+
 	dev->vblank_refcount = kmalloc(sizeof(atomic_t) * num_crtcs,
 				       GFP_KERNEL);
 	if (!dev->vblank_refcount)
@@ -220,8 +227,17 @@ int drm_irq_install(struct drm_device *dev)
 	else
 		irqname = dev->driver->name;
 
-	ret = request_irq(drm_dev_to_irq(dev), dev->driver->irq_handler,
-			  sh_flags, irqname, dev);
+#ifdef DRM_HAS_THREADED_IRQ
+	if (dev->driver->irq_thread_fn)
+		ret = request_threaded_irq(drm_dev_to_irq(dev),
+					   dev->driver->irq_handler,
+					   dev->driver->irq_thread_fn,
+					   sh_flags, irqname, dev);
+	else
+#endif
+		ret = request_irq(drm_dev_to_irq(dev),
+				  dev->driver->irq_handler,
+				  sh_flags, irqname, dev);
 
 	if (ret < 0) {
 		mutex_lock(&dev->struct_mutex);
@@ -341,6 +357,33 @@ u32 drm_vblank_count(struct drm_device *dev, int crtc)
 }
 EXPORT_SYMBOL(drm_vblank_count);
 
+/**
+ * drm_vblank_count_and_time - retrieve "cooked" vblank counter value
+ * and the wall-clock timestamp of that vblank.
+ * @dev: DRM device
+ * @crtc: which counter to retrieve
+ * @vblanktime: Pointer to struct timeval to receive the vblank timestamp.
+ *
+ * The timestamp is taken in drm_handle_vblank, so it doesn't include
+ * the latency of whoever is reading it. It uses the same gettimeofday
+ * time base that DRM_IOCTL_WAIT_VBLANK replies have always used, and is
+ * zero until the first vblank has been handled on @crtc.
+ */
+u32 drm_vblank_count_and_time(struct drm_device *dev, int crtc,
+			      struct timeval *vblanktime)
+{
+	unsigned long irqflags;
+	u32 cur_vblank;
+
+	spin_lock_irqsave(&dev->vblank_time_lock, irqflags);
+	cur_vblank = atomic_read(&dev->_vblank_count[crtc]);
+	*vblanktime = dev->_vblank_time[crtc];
+	spin_unlock_irqrestore(&dev->vblank_time_lock, irqflags);
+
+	return cur_vblank;
+}
+EXPORT_SYMBOL(drm_vblank_count_and_time);
+
 /**
  * drm_update_vblank_count - update the master vblank counter
  * @dev: DRM device
@@ -359,6 +402,7 @@ EXPORT_SYMBOL(drm_vblank_count);
  */
 static void drm_update_vblank_count(struct drm_device *dev, int crtc)
 {
+	struct timeval now;
 	u32 cur_vblank, diff;
 
 	/*
@@ -380,7 +424,21 @@ static void drm_update_vblank_count(struct drm_device *dev, int crtc)
 	DRM_DEBUG("enabling vblank interrupts on crtc %d, missed %d\n",
 		  crtc, diff);
 
+	if (diff == 0)
+		return;
+
+	/*
+	 * There's no timestamp for the vblanks we missed. The last of
+	 * them happened less than a frame ago, so stamp the count with
+	 * the current time rather than leave the stale time of the last
+	 * vblank that was handled.
+	 */
+	do_gettimeofday(&now);
+
+	spin_lock(&dev->vblank_time_lock);
 	atomic_add(diff, &dev->_vblank_count[crtc]);
+	dev->_vblank_time[crtc] = now;
+	spin_unlock(&dev->vblank_time_lock);
 }
 
 /**
@@ -522,6 +580,95 @@ out:
 	return ret;
 }
 
+static void send_vblank_event(struct drm_device *dev,
+			      struct drm_pending_vblank_event *e,
+			      unsigned long seq, struct timeval *now)
+{
+	e->event.sequence = seq;
+	e->event.tv_sec = now->tv_sec;
+	e->event.tv_usec = now->tv_usec;
+
+	list_add_tail(&e->base.link, &e->base.file_priv->event_list);
+	wake_up_interruptible(&e->base.file_priv->event_wait);
+}
+
+/**
+ * drm_queue_vblank_event - queue an event for a vblank sequence
+ * @dev: DRM device
+ * @pipe: crtc the event is for
+ * @vblwait: the wait request, sequence already made absolute
+ * @file_priv: file to deliver the event to
+ *
+ * Takes over the vblank reference acquired by the caller; it is dropped
+ * once the event has been delivered or the file is closed. If the
+ * sequence has already passed the event is delivered right away.
+ */
+static int drm_queue_vblank_event(struct drm_device *dev, int pipe,
+				  union drm_wait_vblank *vblwait,
+				  struct drm_file *file_priv)
+{
+	struct drm_pending_vblank_event *e;
+	struct timeval now;
+	unsigned long flags;
+	unsigned int seq;
+	int ret;
+
+	e = kzalloc(sizeof(*e), GFP_KERNEL);
+	if (e == NULL) {
+		ret = -ENOMEM;
+		goto err_put;
+	}
+
+	e->pipe = pipe;
+	e->event.base.type = DRM_EVENT_VBLANK;
+	e->event.base.length = sizeof(e->event);
+	e->event.user_data = vblwait->request.signal;
+	e->base.event = &e->event.base;
+	e->base.file_priv = file_priv;
+	e->base.destroy = (void (*) (struct drm_pending_event *)) kfree;
+
+	spin_lock_irqsave(&dev->event_lock, flags);
+
+	if (file_priv->event_space < sizeof(e->event)) {
+		ret = -EBUSY;
+		goto err_unlock;
+	}
+
+	file_priv->event_space -= sizeof(e->event);
+	seq = drm_vblank_count_and_time(dev, pipe, &now);
+
+	if ((vblwait->request.type & _DRM_VBLANK_NEXTONMISS) &&
+	    (seq - vblwait->request.sequence) <= (1 << 23)) {
+		vblwait->request.sequence = seq + 1;
+		vblwait->reply.sequence = vblwait->request.sequence;
+	}
+
+	DRM_DEBUG("event on vblank count %d, current %d, crtc %d\n",
+		  vblwait->request.sequence, seq, pipe);
+
+	e->event.sequence = vblwait->request.sequence;
+	if ((seq - vblwait->request.sequence) <= (1 << 23)) {
+		drm_vblank_put(dev, pipe);
+		send_vblank_event(dev, e, seq, &now);
+		vblwait->reply.sequence = seq;
+	} else {
+		/* drm_handle_vblank_events will call drm_vblank_put */
+		list_add_tail(&e->base.link, &dev->vblank_event_list);
+		vblwait->reply.sequence = vblwait->request.sequence;
+	}
+
+	spin_unlock_irqrestore(&dev->event_lock, flags);
+
+	return 0;
+
+err_unlock:
+	spin_unlock_irqrestore(&dev->event_lock, flags);
+	kfree(e);
+err_put:
+	drm_vblank_put(dev, pipe);
+	return ret;
+}
+
 /**
  * Wait for VBLANK.
  *
@@ -581,6 +728,11 @@ int drm_wait_vblank(struct drm_device *dev, void *data,
 		goto done;
 	}
 
+	if (flags & _DRM_VBLANK_EVENT) {
+		/* must hold on to the vblank ref until the event fires */
+		return drm_queue_vblank_event(dev, crtc, vblwait, file_priv);
+	}
+
 	if ((flags & _DRM_VBLANK_NEXTONMISS) &&
 	    (seq - vblwait->request.sequence) <= (1<<23)) {
 		vblwait->request.sequence = seq + 1;
@@ -597,11 +749,10 @@ int drm_wait_vblank(struct drm_device *dev, void *data,
 	if (ret != -EINTR) {
 		struct timeval now;
 
-		do_gettimeofday(&now);
-
+		vblwait->reply.sequence =
+			drm_vblank_count_and_time(dev, crtc, &now);
 		vblwait->reply.tval_sec = now.tv_sec;
 		vblwait->reply.tval_usec = now.tv_usec;
-		vblwait->reply.sequence = drm_vblank_count(dev, crtc);
 		DRM_DEBUG("returning %d to client\n",
 			  vblwait->reply.sequence);
 	} else {
@@ -613,6 +764,34 @@ done:
 	return ret;
 }
 
+static void drm_handle_vblank_events(struct drm_device *dev, int crtc)
+{
+	struct drm_pending_vblank_event *e, *t;
+	struct timeval now;
+	unsigned long flags;
+	unsigned int seq;
+
+	seq = drm_vblank_count_and_time(dev, crtc, &now);
+
+	spin_lock_irqsave(&dev->event_lock, flags);
+
+	list_for_each_entry_safe(e, t, &dev->vblank_event_list, base.link) {
+		if (e->pipe != crtc)
+			continue;
+		if ((seq - e->event.sequence) > (1<<23))
+			continue;
+
+		DRM_DEBUG("vblank event on %d, current %d\n",
+			  e->event.sequence, seq);
+
+		list_del(&e->base.link);
+		drm_vblank_put(dev, e->pipe);
+		send_vblank_event(dev, e, seq, &now);
+	}
+
+	spin_unlock_irqrestore(&dev->event_lock, flags);
+}
+
 /**
  * drm_handle_vblank - handle a vblank event
  * @dev: DRM device
@@ -623,7 +802,16 @@ done:
  */
 void drm_handle_vblank(struct drm_device *dev, int crtc)
 {
+	struct timeval now;
+	unsigned long irqflags;
+
+	do_gettimeofday(&now);
+	spin_lock_irqsave(&dev->vblank_time_lock, irqflags);
+	dev->_vblank_time[crtc] = now;
 	atomic_inc(&dev->_vblank_count[crtc]);
+	spin_unlock_irqrestore(&dev->vblank_time_lock, irqflags);
+
 	DRM_WAKEUP(&dev->vbl_queue[crtc]);
+	drm_handle_vblank_events(dev, crtc);
 }
 EXPORT_SYMBOL(drm_handle_vblank);
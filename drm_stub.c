@@ -232,9 +232,11 @@ static int drm_fill_in_dev(struct drm_device * dev, struct pci_dev *pdev,
 	INIT_LIST_HEAD(&dev->ctxlist);
 	INIT_LIST_HEAD(&dev->vmalist);
 	INIT_LIST_HEAD(&dev->maplist);
+	INIT_LIST_HEAD(&dev->vblank_event_list);
 
 	spin_lock_init(&dev->count_lock);
 	spin_lock_init(&dev->drw_lock);
+	spin_lock_init(&dev->event_lock);
 	init_timer(&dev->timer);
 	mutex_init(&dev->struct_mutex);
 	mutex_init(&dev->ctxlist_mutex);
@@ -249,6 +251,10 @@ static int drm_fill_in_dev(struct drm_device * dev, struct pci_dev *pdev,
 	dev->hose = pdev->sysdata;
 #endif
 
+	dev->ioctl_pcpu = alloc_percpu(struct drm_ioctl_pcpu);
+	if (!dev->ioctl_pcpu)
+		return -ENOMEM;
+
 	if (drm_ht_create(&dev->map_hash, 12)) {
 		return -ENOMEM;
 	}
@@ -447,6 +453,7 @@ err_g3:
 		drm_put_minor(&dev->control);
 err_g2:
 	pci_disable_device(pdev);
+	free_percpu(dev->ioctl_pcpu);
 err_g1:
 	kfree(dev);
 	mutex_unlock(&drm_global_mutex);
@@ -542,6 +549,7 @@ void drm_put_dev(struct drm_device *dev)
 		kfree(dev->devname);
 		dev->devname = NULL;
 	}
+	free_percpu(dev->ioctl_pcpu);
 	kfree(dev);
 }
 EXPORT_SYMBOL(drm_put_dev);
@@ -44,14 +44,32 @@
 #define TTM_BO_HASH_ORDER 13
 
 static int ttm_bo_setup_vm(struct ttm_buffer_object *bo);
-static int ttm_bo_swapout(struct ttm_mem_shrink *shrink);
+static int ttm_bo_swapout(struct ttm_mem_shrink *shrink, uint64_t target);
 static void ttm_bo_global_kobj_release(struct kobject *kobj);
 
+/*
+ * A bo whose decayed caching change count reaches this limit is kept
+ * cached wherever the placement allows it. The count halves every
+ * TTM_BO_CACHING_DECAY jiffies.
+ */
+#define TTM_BO_CACHING_FLIP_LIMIT 4
+#define TTM_BO_CACHING_DECAY HZ
+
 static struct attribute ttm_bo_count = {
 	.name = "bo_count",
 	.mode = S_IRUGO
 };
 
+static struct attribute ttm_bo_caching_changes = {
+	.name = "caching_changes",
+	.mode = S_IRUGO
+};
+
+static struct attribute ttm_bo_caching_rate = {
+	.name = "caching_changes_per_sec",
+	.mode = S_IRUGO
+};
+
 static inline int ttm_mem_type_from_flags(uint32_t flags, uint32_t *mem_type)
 {
 	int i;
@@ -106,13 +124,39 @@ static ssize_t ttm_bo_global_show(struct kobject *kobj,
 {
 	struct ttm_bo_global *glob =
 		container_of(kobj, struct ttm_bo_global, kobj);
+	unsigned long changes, elapsed, rate;
+
+	if (attr == &ttm_bo_count)
+		return snprintf(buffer, PAGE_SIZE, "%lu\n",
+				(unsigned long) atomic_read(&glob->bo_count));
+
+	changes = (unsigned long) atomic_read(&glob->caching_changes);
+	if (attr == &ttm_bo_caching_changes)
+		return snprintf(buffer, PAGE_SIZE, "%lu\n", changes);
 
-	return snprintf(buffer, PAGE_SIZE, "%lu\n",
-			(unsigned long) atomic_read(&glob->bo_count));
+	/*
+	 * The rate is averaged over the time since the previous sample,
+	 * which is taken at most once a second.
+	 */
+
+	spin_lock(&glob->lru_lock);
+	elapsed = jiffies - glob->caching_rate_stamp;
+	if (elapsed >= HZ) {
+		glob->caching_rate = (changes - glob->caching_rate_base) * HZ /
+			elapsed;
+		glob->caching_rate_base = changes;
+		glob->caching_rate_stamp = jiffies;
+	}
+	rate = glob->caching_rate;
+	spin_unlock(&glob->lru_lock);
+
+	return snprintf(buffer, PAGE_SIZE, "%lu\n", rate);
 }
 
 static struct attribute *ttm_bo_global_attrs[] = {
 	&ttm_bo_count,
+	&ttm_bo_caching_changes,
+	&ttm_bo_caching_rate,
 	NULL
 };
 
@@ -369,6 +413,29 @@ static int ttm_bo_add_ttm(struct ttm_buffer_object *bo, bool zero_alloc)
 	return ret;
 }
 
+static void ttm_bo_caching_decay(struct ttm_buffer_object *bo)
+{
+	unsigned long periods =
+		(jiffies - bo->caching_stamp) / TTM_BO_CACHING_DECAY;
+
+	if (periods == 0)
+		return;
+
+	bo->caching_flips = (periods < 32) ? bo->caching_flips >> periods : 0;
+	bo->caching_stamp += periods * TTM_BO_CACHING_DECAY;
+}
+
+/**
+ * ttm_bo_caching_unstable - Whether the bo keeps changing caching.
+ *
+ * @bo: The buffer object. Must be reserved.
+ */
+static bool ttm_bo_caching_unstable(struct ttm_buffer_object *bo)
+{
+	ttm_bo_caching_decay(bo);
+	return bo->caching_flips >= TTM_BO_CACHING_FLIP_LIMIT;
+}
+
 static int ttm_bo_handle_move_mem(struct ttm_buffer_object *bo,
 				  struct ttm_mem_reg *mem,
 				  bool evict, bool interruptible,
@@ -379,6 +446,8 @@ static int ttm_bo_handle_move_mem(struct ttm_buffer_object *bo,
 	bool new_is_pci = ttm_mem_reg_is_pci(bdev, mem);
 	struct ttm_mem_type_manager *old_man = &bdev->man[bo->mem.mem_type];
 	struct ttm_mem_type_manager *new_man = &bdev->man[mem->mem_type];
+	uint32_t old_caching = bo->mem.placement & TTM_PL_MASK_CACHING;
+	bool notified = false;
 	int ret = 0;
 
 	if (old_is_pci || new_is_pci ||
@@ -410,6 +479,8 @@ static int ttm_bo_handle_move_mem(struct ttm_buffer_object *bo,
 		}
 
 		if (bo->mem.mem_type == TTM_PL_SYSTEM) {
+			if (bdev->driver->move_notify)
+				bdev->driver->move_notify(bo, mem);
 			bo->mem = *mem;
 			mem->mm_node = NULL;
 			goto moved;
@@ -417,8 +488,10 @@ static int ttm_bo_handle_move_mem(struct ttm_buffer_object *bo,
 
 	}
 
-	if (bdev->driver->move_notify)
+	if (bdev->driver->move_notify) {
 		bdev->driver->move_notify(bo, mem);
+		notified = true;
+	}
 
 	if (!(old_man->flags & TTM_MEMTYPE_FLAG_FIXED) &&
 	    !(new_man->flags & TTM_MEMTYPE_FLAG_FIXED))
@@ -433,6 +506,12 @@ static int ttm_bo_handle_move_mem(struct ttm_buffer_object *bo,
 		goto out_err;
 
 moved:
+	if (bo->ttm != NULL &&
+	    (bo->mem.placement & TTM_PL_MASK_CACHING) != old_caching) {
+		ttm_bo_caching_decay(bo);
+		bo->caching_flips++;
+	}
+
 	if (bo->evicted) {
 		ret = bdev->driver->invalidate_caches(bdev, bo->mem.placement);
 		if (ret)
@@ -450,6 +529,12 @@ moved:
 	return 0;
 
 out_err:
+	/*
+	 * The bo stays where it was. Tell the driver.
+	 */
+	if (notified)
+		bdev->driver->move_notify(bo, &bo->mem);
+
 	new_man = &bdev->man[bo->mem.mem_type];
 	if ((new_man->flags & TTM_MEMTYPE_FLAG_FIXED) && bo->ttm) {
 		ttm_tt_unbind(bo->ttm);
@@ -470,6 +555,9 @@ out_err:
 
 static void ttm_bo_cleanup_memtype_use(struct ttm_buffer_object *bo)
 {
+	if (bo->bdev->driver->move_notify)
+		bo->bdev->driver->move_notify(bo, NULL);
+
 	if (bo->ttm) {
 		ttm_tt_unbind(bo->ttm);
 		ttm_tt_destroy(bo->ttm);
@@ -791,6 +879,24 @@ retry:
 	}
 
 	bo = list_first_entry(&man->lru, struct ttm_buffer_object, lru);
+
+	/*
+	 * Let the driver pick a preferred victim, in LRU order.
+	 */
+
+	if (bdev->driver->evict_prefer &&
+	    (bdev->driver->evict_prefer_active == NULL ||
+	     bdev->driver->evict_prefer_active(bdev, mem_type))) {
+		struct ttm_buffer_object *entry;
+
+		list_for_each_entry(entry, &man->lru, lru) {
+			if (bdev->driver->evict_prefer(entry)) {
+				bo = entry;
+				break;
+			}
+		}
+	}
+
 	kref_get(&bo->list_kref);
 
 	if (!list_empty(&bo->ddestroy)) {
@@ -879,18 +985,29 @@ static int ttm_bo_mem_force_space(struct ttm_buffer_object *bo,
 	return 0;
 }
 
-static uint32_t ttm_bo_select_caching(struct ttm_mem_type_manager *man,
+static uint32_t ttm_bo_select_caching(struct ttm_buffer_object *bo,
+				      struct ttm_mem_type_manager *man,
 				      uint32_t cur_placement,
 				      uint32_t proposed_placement)
 {
 	uint32_t caching = proposed_placement & TTM_PL_MASK_CACHING;
 	uint32_t result = proposed_placement & ~TTM_PL_MASK_CACHING;
 
+	/**
+	 * Buffers that keep migrating between placements with different
+	 * caching stay cached, which system memory always allows, rather
+	 * than paying for an attribute change and a cache flush each time.
+	 */
+
+	if ((TTM_PL_FLAG_CACHED & caching) != 0 &&
+	    ttm_bo_caching_unstable(bo))
+		result |= TTM_PL_FLAG_CACHED;
+
 	/**
 	 * Keep current caching if possible.
 	 */
 
-	if ((cur_placement & caching) != 0)
+	else if ((cur_placement & caching) != 0)
 		result |= (cur_placement & caching);
 	else if ((man->default_caching & caching) != 0)
 		result |= man->default_caching;
@@ -935,6 +1052,18 @@ static bool ttm_bo_mt_compatible(struct ttm_mem_type_manager *man,
  * ttm_bo_mem_force_space is attempted in priority order to evict and find
  * space.
  */
+/**
+ * Ask the driver whether placing @bo in @mem_type would take its owner
+ * over quota. Such placements are skipped rather than evicted for.
+ */
+static bool ttm_bo_quota_exceeded(struct ttm_buffer_object *bo,
+				  uint32_t mem_type)
+{
+	struct ttm_bo_driver *driver = bo->bdev->driver;
+
+	return driver->quota_exceeded && driver->quota_exceeded(bo, mem_type);
+}
+
 int ttm_bo_mem_space(struct ttm_buffer_object *bo,
 			struct ttm_placement *placement,
 			struct ttm_mem_reg *mem,
@@ -947,6 +1076,7 @@ int ttm_bo_mem_space(struct ttm_buffer_object *bo,
 	uint32_t cur_flags = 0;
 	bool type_found = false;
 	bool type_ok = false;
+	bool quota_hit = false;
 	bool has_erestartsys = false;
 	int i, ret;
 
@@ -967,7 +1097,13 @@ int ttm_bo_mem_space(struct ttm_buffer_object *bo,
 		if (!type_ok)
 			continue;
 
-		cur_flags = ttm_bo_select_caching(man, bo->mem.placement,
+		if (ttm_bo_quota_exceeded(bo, mem_type)) {
+			quota_hit = true;
+			continue;
+		}
+
+		cur_flags = ttm_bo_select_caching(bo, man,
+						  bo->mem.placement,
 						  cur_flags);
 		/*
 		 * Use the access and other non-mapping-related flag bits from
@@ -995,7 +1131,7 @@ int ttm_bo_mem_space(struct ttm_buffer_object *bo,
 		return 0;
 	}
 
-	if (!type_found)
+	if (!type_found && !quota_hit)
 		return -EINVAL;
 
 	for (i = 0; i < placement->num_busy_placement; ++i) {
@@ -1012,8 +1148,11 @@ int ttm_bo_mem_space(struct ttm_buffer_object *bo,
 						placement->busy_placement[i],
 						&cur_flags))
 			continue;
+		if (ttm_bo_quota_exceeded(bo, mem_type))
+			continue;
 
-		cur_flags = ttm_bo_select_caching(man, bo->mem.placement,
+		cur_flags = ttm_bo_select_caching(bo, man,
+						  bo->mem.placement,
 						  cur_flags);
 		/*
 		 * Use the access and other non-mapping-related flag bits from
@@ -1213,6 +1352,8 @@ int ttm_bo_init(struct ttm_bo_device *bdev,
 	bo->buffer_start = buffer_start & PAGE_MASK;
 	bo->priv_flags = 0;
 	bo->mem.placement = (TTM_PL_FLAG_SYSTEM | TTM_PL_FLAG_CACHED);
+	bo->caching_flips = 0;
+	bo->caching_stamp = jiffies;
 	bo->seq_valid = false;
 	bo->persistant_swap_storage = persistant_swap_storage;
 	bo->acc_size = acc_size;
@@ -1448,7 +1589,8 @@ int ttm_bo_global_init(struct drm_global_reference *ref)
 	INIT_LIST_HEAD(&glob->swap_lru);
 	INIT_LIST_HEAD(&glob->device_list);
 
-	ttm_mem_init_shrink(&glob->shrink, ttm_bo_swapout);
+	ttm_mem_init_shrink(&glob->shrink, ttm_bo_swapout,
+			    TTM_SHRINK_PRIO_SWAP);
 	ret = ttm_mem_register_shrink(glob->mem_glob, &glob->shrink);
 	if (unlikely(ret != 0)) {
 		printk(KERN_ERR TTM_PFX
@@ -1464,6 +1606,10 @@ int ttm_bo_global_init(struct drm_global_reference *ref)
 		ttm_round_pot(sizeof(struct ttm_buffer_object));
 
 	atomic_set(&glob->bo_count, 0);
+	atomic_set(&glob->caching_changes, 0);
+	glob->caching_rate_stamp = jiffies;
+	glob->caching_rate_base = 0;
+	glob->caching_rate = 0;
 
 	ret = kobject_init_and_add(
 		&glob->kobj, &ttm_bo_glob_kobj_type, ttm_get_kobj(), "buffer_objects");
@@ -1780,14 +1926,13 @@ void ttm_bo_synccpu_write_release(struct ttm_buffer_object *bo)
 EXPORT_SYMBOL(ttm_bo_synccpu_write_release);
 
 /**
- * A buffer object shrink method that tries to swap out the first
- * buffer object on the bo_global::swap_lru list.
+ * Try to swap out the first buffer object on the bo_global::swap_lru list.
+ * On success, the number of pages swapped out is returned in @num_pages.
  */
 
-static int ttm_bo_swapout(struct ttm_mem_shrink *shrink)
+static int ttm_bo_swapout_one(struct ttm_bo_global *glob,
+			      unsigned long *num_pages)
 {
-	struct ttm_bo_global *glob =
-	    container_of(shrink, struct ttm_bo_global, shrink);
 	struct ttm_buffer_object *bo;
 	int ret = -EBUSY;
 	int put_count;
@@ -1868,6 +2013,8 @@ static int ttm_bo_swapout(struct ttm_mem_shrink *shrink)
 		bo->bdev->driver->swap_notify(bo);
 
 	ret = ttm_tt_swapout(bo->ttm, bo->persistant_swap_storage);
+	if (likely(ret == 0))
+		*num_pages = bo->num_pages;
 out:
 
 	/**
@@ -1882,9 +2029,35 @@ out:
 	return ret;
 }
 
+/**
+ * A buffer object shrink method that swaps out buffer objects from the
+ * head of the bo_global::swap_lru list until at least @target bytes
+ * have been swapped out, or there is nothing more to swap.
+ */
+
+static int ttm_bo_swapout(struct ttm_mem_shrink *shrink, uint64_t target)
+{
+	struct ttm_bo_global *glob =
+	    container_of(shrink, struct ttm_bo_global, shrink);
+	uint64_t swapped = 0;
+	unsigned long num_pages;
+	int ret;
+
+	do {
+		ret = ttm_bo_swapout_one(glob, &num_pages);
+		if (unlikely(ret != 0))
+			break;
+		swapped += (uint64_t) num_pages << PAGE_SHIFT;
+	} while (swapped < target);
+
+	return (swapped != 0) ? 0 : ret;
+}
+
 void ttm_bo_swapout_all(struct ttm_bo_device *bdev)
 {
-	while (ttm_bo_swapout(&bdev->glob->shrink) == 0)
+	unsigned long num_pages;
+
+	while (ttm_bo_swapout_one(bdev->glob, &num_pages) == 0)
 		;
 }
 EXPORT_SYMBOL(ttm_bo_swapout_all);
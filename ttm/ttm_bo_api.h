@@ -163,6 +163,8 @@ struct ttm_tt;
  * holds a pointer to a persistant shmem object.
  * @ttm: TTM structure holding system pages.
  * @evicted: Whether the object was evicted without user-space knowing.
+ * @caching_flips: Decaying count of caching state changes on migration.
+ * @caching_stamp: Time in jiffies @caching_flips was last decayed.
  * @cpu_writes: For synchronization. Number of cpu writers.
  * @lru: List head for the lru list.
  * @ddestroy: List head for the delayed destroy list.
@@ -224,6 +226,8 @@ struct ttm_buffer_object {
 	struct file *persistant_swap_storage;
 	struct ttm_tt *ttm;
 	bool evicted;
+	unsigned int caching_flips;
+	unsigned long caching_stamp;
 
 	/**
 	 * Members protected by the bo::reserved lock only when written to.
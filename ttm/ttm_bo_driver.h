@@ -435,9 +435,48 @@ struct ttm_bo_driver {
 	void *(*sync_obj_ref) (void *sync_obj);
 
 	/* hook to notify driver about a driver move so it
-	 * can do tiling things */
+	 * can do tiling things. Called with the bo reserved, before
+	 * every placement change and with @new_mem == NULL when the
+	 * bo's memory is released. If a move fails, it is called again
+	 * with the bo's current placement. */
 	void (*move_notify)(struct ttm_buffer_object *bo,
 			    struct ttm_mem_reg *new_mem);
+	/**
+	 * struct ttm_bo_driver member quota_exceeded
+	 *
+	 * @bo: Pointer to a buffer object.
+	 * @mem_type: Memory type the bo is about to be placed in.
+	 *
+	 * Optional. Return true if placing @bo in @mem_type would exceed a
+	 * driver-defined quota. ttm_bo_mem_space then skips the placement.
+	 */
+	bool (*quota_exceeded)(struct ttm_buffer_object *bo,
+			       uint32_t mem_type);
+
+	/**
+	 * struct ttm_bo_driver member evict_prefer
+	 *
+	 * @bo: Pointer to a buffer object on a memory type LRU list.
+	 *
+	 * Optional. Return true if @bo should be evicted before buffers
+	 * ahead of it on the LRU list. Called with the lru lock held.
+	 */
+	bool (*evict_prefer)(struct ttm_buffer_object *bo);
+
+	/**
+	 * struct ttm_bo_driver member evict_prefer_active
+	 *
+	 * @bdev: Pointer to a struct ttm_bo_device.
+	 * @mem_type: The memory type about to be evicted from.
+	 *
+	 * Optional. Return false if evict_prefer can't return true for any
+	 * buffer in @mem_type, so that eviction doesn't need to walk the
+	 * LRU list. If not set, the list is always walked. Called with the
+	 * lru lock held.
+	 */
+	bool (*evict_prefer_active)(struct ttm_bo_device *bdev,
+				    uint32_t mem_type);
+
 	/* notify the driver we are taking a fault on this BO
 	 * and have reserved it */
 	int (*fault_reserve_notify)(struct ttm_buffer_object *bo);
@@ -512,6 +551,14 @@ struct ttm_bo_global {
 	 * Internal protection.
 	 */
 	atomic_t bo_count;
+	atomic_t caching_changes;
+
+	/**
+	 * Protected by the lru_lock.
+	 */
+	unsigned long caching_rate_stamp;
+	unsigned long caching_rate_base;
+	unsigned long caching_rate;
 };
 
 
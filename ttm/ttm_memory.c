@@ -34,9 +34,28 @@
 #include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/slab.h>
+#include <linux/percpu.h>
 
 #define TTM_MEMORY_ALLOC_RETRIES 4
 
+/*
+ * Amount of accounted memory each cpu may keep cached per zone.
+ * Allocations and frees smaller than this are served from the
+ * local cpu cache without touching glob->lock.
+ */
+#define TTM_MEM_PCPU_SLACK (16 * PAGE_SIZE)
+
+/**
+ * struct ttm_mem_pcpu - Per-cpu accounting cache.
+ *
+ * @credit: Memory already accounted in the zone's used_mem member
+ * but not yet handed out to an allocation, indexed as glob->zones.
+ */
+
+struct ttm_mem_pcpu {
+	uint64_t credit[TTM_MEM_MAX_ZONES];
+};
+
 struct ttm_mem_zone {
 	struct kobject kobj;
 	struct ttm_mem_global *glob;
@@ -106,6 +125,7 @@ static ssize_t ttm_mem_zone_show(struct kobject *kobj,
 }
 
 static void ttm_check_swapping(struct ttm_mem_global *glob);
+static void ttm_mem_pcpu_drain(struct ttm_mem_global *glob);
 
 static ssize_t ttm_mem_zone_store(struct kobject *kobj,
 				  struct attribute *attr,
@@ -181,12 +201,24 @@ static struct kobj_type ttm_mem_glob_kobj_type = {
 	.release = &ttm_mem_global_kobj_release,
 };
 
-static bool ttm_zones_above_swap_target(struct ttm_mem_global *glob,
-					bool from_wq, uint64_t extra)
+/**
+ * ttm_zones_swap_deficit - Compute how much memory needs to be reclaimed.
+ *
+ * @glob: The memory accounting object.
+ * @from_wq: Whether we're called from the swap workqueue.
+ * @extra: Extra memory the caller is about to allocate.
+ *
+ * Returns 0 if all zones are below their target. Otherwise the largest
+ * amount by which a zone exceeds its target, plus @extra.
+ */
+
+static uint64_t ttm_zones_swap_deficit(struct ttm_mem_global *glob,
+				       bool from_wq, uint64_t extra)
 {
 	unsigned int i;
 	struct ttm_mem_zone *zone;
 	uint64_t target;
+	uint64_t deficit = 0;
 
 	for (i = 0; i < glob->num_zones; ++i) {
 		zone = glob->zones[i];
@@ -201,14 +233,16 @@ static bool ttm_zones_above_swap_target(struct ttm_mem_global *glob,
 		target = (extra > target) ? 0ULL : target;
 
 		if (zone->used_mem > target)
-			return true;
+			deficit = max(deficit, zone->used_mem - target + extra);
 	}
-	return false;
+	return deficit;
 }
 
 /**
- * At this point we only support a single shrink callback.
- * Extend this if needed, perhaps using a linked list of callbacks.
+ * Call the registered shrink callbacks, cheapest first, until all
+ * zones are below their target. A callback is called repeatedly with
+ * the current deficit as long as it manages to reclaim something.
+ * When it fails, we move on to the next, more expensive, callback.
  * Note that this function is reentrant:
  * many threads may try to swap out at any given time.
  */
@@ -218,25 +252,35 @@ static void ttm_shrink(struct ttm_mem_global *glob, bool from_wq,
 {
 	int ret;
 	struct ttm_mem_shrink *shrink;
+	unsigned int level = 0;
+	unsigned int i;
+	uint64_t deficit;
 
 	spin_lock(&glob->lock);
-	if (glob->shrink == NULL)
-		goto out;
+	while ((deficit = ttm_zones_swap_deficit(glob, from_wq, extra)) != 0) {
+
+		/*
+		 * Look up the callback by position rather than keeping
+		 * a pointer, since the list may change while unlocked.
+		 */
+
+		i = 0;
+		list_for_each_entry(shrink, &glob->shrink_list, head) {
+			if (i++ == level)
+				break;
+		}
+		if (&shrink->head == &glob->shrink_list)
+			break;
 
-	while (ttm_zones_above_swap_target(glob, from_wq, extra)) {
-		shrink = glob->shrink;
 		spin_unlock(&glob->lock);
-		ret = shrink->do_shrink(shrink);
+		ret = shrink->do_shrink(shrink, deficit);
 		spin_lock(&glob->lock);
 		if (unlikely(ret != 0))
-			goto out;
+			++level;
 	}
-out:
 	spin_unlock(&glob->lock);
 }
 
-
-
 static void ttm_shrink_work(struct work_struct *work)
 {
 	struct ttm_mem_global *glob =
@@ -368,12 +412,17 @@ int ttm_mem_global_init(struct ttm_mem_global *glob)
 	struct ttm_mem_zone *zone;
 
 	spin_lock_init(&glob->lock);
+	INIT_LIST_HEAD(&glob->shrink_list);
+	glob->pcpu = alloc_percpu(struct ttm_mem_pcpu);
+	if (unlikely(glob->pcpu == NULL))
+		return -ENOMEM;
 	glob->swap_queue = create_singlethread_workqueue("ttm_swap");
 	INIT_WORK(&glob->work, ttm_shrink_work);
 	init_waitqueue_head(&glob->queue);
 	ret = kobject_init_and_add(
 		&glob->kobj, &ttm_mem_glob_kobj_type, ttm_get_kobj(), "memory_accounting");
 	if (unlikely(ret != 0)) {
+		free_percpu(glob->pcpu);
 		kobject_put(&glob->kobj);
 		return ret;
 	}
@@ -417,16 +466,162 @@ void ttm_mem_global_release(struct ttm_mem_global *glob)
 	flush_workqueue(glob->swap_queue);
 	destroy_workqueue(glob->swap_queue);
 	glob->swap_queue = NULL;
+	ttm_mem_pcpu_drain(glob);
+	free_percpu(glob->pcpu);
+	glob->pcpu = NULL;
 	for (i = 0; i < glob->num_zones; ++i) {
 		zone = glob->zones[i];
 		kobject_del(&zone->kobj);
 		kobject_put(&zone->kobj);
-			}
+	}
 	kobject_del(&glob->kobj);
 	kobject_put(&glob->kobj);
 }
 EXPORT_SYMBOL(ttm_mem_global_release);
 
+/**
+ * ttm_mem_pcpu_take - Try to satisfy an allocation from the local cpu cache.
+ *
+ * @glob: The memory accounting object.
+ * @single_zone: Zone to account in, or NULL for all zones.
+ * @amount: Number of bytes to account.
+ *
+ * Returns true if the allocation was accounted from the cache.
+ */
+
+static bool ttm_mem_pcpu_take(struct ttm_mem_global *glob,
+			      struct ttm_mem_zone *single_zone,
+			      uint64_t amount)
+{
+	struct ttm_mem_pcpu *pcpu;
+	unsigned int i;
+	bool ret = false;
+
+	if (amount > TTM_MEM_PCPU_SLACK)
+		return false;
+
+	pcpu = per_cpu_ptr(glob->pcpu, get_cpu());
+	for (i = 0; i < glob->num_zones; ++i) {
+		if (single_zone && glob->zones[i] != single_zone)
+			continue;
+		if (pcpu->credit[i] < amount)
+			goto out;
+	}
+
+	for (i = 0; i < glob->num_zones; ++i) {
+		if (single_zone && glob->zones[i] != single_zone)
+			continue;
+		pcpu->credit[i] -= amount;
+	}
+	ret = true;
+out:
+	put_cpu();
+	return ret;
+}
+
+/**
+ * ttm_mem_pcpu_give - Try to return freed memory to the local cpu cache.
+ *
+ * @glob: The memory accounting object.
+ * @single_zone: Zone the memory was accounted in, or NULL for all zones.
+ * @amount: Number of bytes to return.
+ *
+ * Returns true if the memory was absorbed by the cache. If the cache
+ * would grow beyond twice its slack, returns false and the caller
+ * must return the memory to the zones under the global lock.
+ */
+
+static bool ttm_mem_pcpu_give(struct ttm_mem_global *glob,
+			      struct ttm_mem_zone *single_zone,
+			      uint64_t amount)
+{
+	struct ttm_mem_pcpu *pcpu;
+	unsigned int i;
+	bool ret = false;
+
+	if (amount > TTM_MEM_PCPU_SLACK)
+		return false;
+
+	pcpu = per_cpu_ptr(glob->pcpu, get_cpu());
+	for (i = 0; i < glob->num_zones; ++i) {
+		if (single_zone && glob->zones[i] != single_zone)
+			continue;
+		if (pcpu->credit[i] + amount > 2 * TTM_MEM_PCPU_SLACK)
+			goto out;
+	}
+
+	for (i = 0; i < glob->num_zones; ++i) {
+		if (single_zone && glob->zones[i] != single_zone)
+			continue;
+		pcpu->credit[i] += amount;
+	}
+	ret = true;
+out:
+	put_cpu();
+	return ret;
+}
+
+/**
+ * ttm_mem_pcpu_refill - Top up the local cpu cache.
+ *
+ * @glob: The memory accounting object.
+ * @single_zone: Zone to refill, or NULL for all zones.
+ *
+ * Must be called with glob->lock held, which also keeps us on the
+ * current cpu. The cache is only refilled while a zone stays below
+ * its non-emergency limit, so cached credit never lets an
+ * unprivileged allocation dip into the emergency reserve.
+ */
+
+static void ttm_mem_pcpu_refill(struct ttm_mem_global *glob,
+				struct ttm_mem_zone *single_zone)
+{
+	struct ttm_mem_pcpu *pcpu =
+		per_cpu_ptr(glob->pcpu, smp_processor_id());
+	struct ttm_mem_zone *zone;
+	uint64_t fill;
+	unsigned int i;
+
+	for (i = 0; i < glob->num_zones; ++i) {
+		zone = glob->zones[i];
+		if (single_zone && zone != single_zone)
+			continue;
+		if (pcpu->credit[i] >= TTM_MEM_PCPU_SLACK)
+			continue;
+		fill = TTM_MEM_PCPU_SLACK - pcpu->credit[i];
+		if (zone->used_mem + fill > zone->max_mem)
+			continue;
+		zone->used_mem += fill;
+		pcpu->credit[i] += fill;
+	}
+}
+
+/**
+ * ttm_mem_pcpu_drain - Return all cached credit to the zones.
+ *
+ * @glob: The memory accounting object.
+ *
+ * Only safe when no other thread is accounting memory, that is
+ * at teardown.
+ */
+
+static void ttm_mem_pcpu_drain(struct ttm_mem_global *glob)
+{
+	struct ttm_mem_pcpu *pcpu;
+	unsigned int i;
+	int cpu;
+
+	spin_lock(&glob->lock);
+	for_each_possible_cpu(cpu) {
+		pcpu = per_cpu_ptr(glob->pcpu, cpu);
+		for (i = 0; i < glob->num_zones; ++i) {
+			glob->zones[i]->used_mem -= pcpu->credit[i];
+			pcpu->credit[i] = 0;
+		}
+	}
+	spin_unlock(&glob->lock);
+}
+
 static void ttm_check_swapping(struct ttm_mem_global *glob)
 {
 	bool needs_swapping = false;
@@ -456,6 +651,9 @@ static void ttm_mem_global_free_zone(struct ttm_mem_global *glob,
 	unsigned int i;
 	struct ttm_mem_zone *zone;
 
+	if (ttm_mem_pcpu_give(glob, single_zone, amount))
+		return;
+
 	spin_lock(&glob->lock);
 	for (i = 0; i < glob->num_zones; ++i) {
 		zone = glob->zones[i];
@@ -482,6 +680,9 @@ static int ttm_mem_global_reserve(struct ttm_mem_global *glob,
 	unsigned int i;
 	struct ttm_mem_zone *zone;
 
+	if (reserve && ttm_mem_pcpu_take(glob, single_zone, amount))
+		return 0;
+
 	spin_lock(&glob->lock);
 	for (i = 0; i < glob->num_zones; ++i) {
 		zone = glob->zones[i];
@@ -502,6 +703,7 @@ static int ttm_mem_global_reserve(struct ttm_mem_global *glob,
 				continue;
 			zone->used_mem += amount;
 		}
+		ttm_mem_pcpu_refill(glob, single_zone);
 	}
 
 	ret = 0;
@@ -34,11 +34,32 @@
 #include <linux/errno.h>
 #include <linux/kobject.h>
 #include <linux/mm.h>
+#include <linux/list.h>
+
+/**
+ * Shrink priorities. Shrinkers are called cheapest first, that is in
+ * increasing priority order, and a more expensive shrinker is only
+ * called when all cheaper ones have run out of things to reclaim.
+ *
+ * TTM_SHRINK_PRIO_CACHE: Cached memory that isn't in use.
+ * TTM_SHRINK_PRIO_IDLE: Idle resources that need to be recreated on use.
+ * TTM_SHRINK_PRIO_SWAP: Buffer object contents that need to be swapped out.
+ */
+
+#define TTM_SHRINK_PRIO_CACHE  0
+#define TTM_SHRINK_PRIO_IDLE   64
+#define TTM_SHRINK_PRIO_SWAP   128
 
 /**
  * struct ttm_mem_shrink - callback to shrink TTM memory usage.
  *
- * @do_shrink: The callback function.
+ * @head: List head for the struct ttm_mem_global shrink list.
+ * @priority: Reclaim cost. Lower values are called first.
+ * @do_shrink: The callback function. The second argument is the
+ * number of bytes the caller would like to see reclaimed. The callback
+ * may reclaim less or more than that, but should try to batch its work
+ * accordingly. It should return 0 if anything was reclaimed, and
+ * an error code (typically -EBUSY) if there was nothing to reclaim.
  *
  * Arguments to the do_shrink functions are intended to be passed using
  * inheritance. That is, the argument class derives from struct ttm_mem_srink,
@@ -46,27 +67,31 @@
  */
 
 struct ttm_mem_shrink {
-	int (*do_shrink) (struct ttm_mem_shrink *);
+	struct list_head head;
+	unsigned int priority;
+	int (*do_shrink) (struct ttm_mem_shrink *, uint64_t);
 };
 
 /**
  * struct ttm_mem_global - Global memory accounting structure.
  *
- * @shrink: A single callback to shrink TTM memory usage. Extend this
- * to a linked list to be able to handle multiple callbacks when needed.
+ * @shrink_list: Registered shrink callbacks, sorted by priority.
  * @swap_queue: A workqueue to handle shrinking in low memory situations. We
  * need a separate workqueue since it will spend a lot of time waiting
  * for the GPU, and this will otherwise block other workqueue tasks(?)
  * At this point we use only a single-threaded workqueue.
  * @work: The workqueue callback for the shrink queue.
  * @queue: Wait queue for processes suspended waiting for memory.
- * @lock: Lock to protect the @shrink - and the memory accounting members,
+ * @lock: Lock to protect the @shrink_list - and the memory accounting members,
  * that is, essentially the whole structure with some exceptions.
  * @zones: Array of pointers to accounting zones.
  * @num_zones: Number of populated entries in the @zones array.
  * @zone_kernel: Pointer to the kernel zone.
  * @zone_highmem: Pointer to the highmem zone if there is one.
  * @zone_dma32: Pointer to the dma32 zone if there is one.
+ * @pcpu: Per-cpu caches of already accounted memory. Small allocations
+ * and frees are served from these without taking @lock, and the zone
+ * limits are only checked when a cpu's cache runs dry.
  *
  * Note that this structure is not per device. It should be global for all
  * graphics devices.
@@ -74,9 +99,10 @@ struct ttm_mem_shrink {
 
 #define TTM_MEM_MAX_ZONES 2
 struct ttm_mem_zone;
+struct ttm_mem_pcpu;
 struct ttm_mem_global {
 	struct kobject kobj;
-	struct ttm_mem_shrink *shrink;
+	struct list_head shrink_list;
 	struct workqueue_struct *swap_queue;
 	struct work_struct work;
 	wait_queue_head_t queue;
@@ -89,6 +115,7 @@ struct ttm_mem_global {
 #else
 	struct ttm_mem_zone *zone_dma32;
 #endif
+	struct ttm_mem_pcpu *pcpu;
 };
 
 /**
@@ -96,11 +123,16 @@ struct ttm_mem_global {
  *
  * @shrink: The object to initialize.
  * @func: The callback function.
+ * @priority: The reclaim cost of this callback. See TTM_SHRINK_PRIO_xxx.
  */
 
 static inline void ttm_mem_init_shrink(struct ttm_mem_shrink *shrink,
-				       int (*func) (struct ttm_mem_shrink *))
+				       int (*func) (struct ttm_mem_shrink *,
+						    uint64_t),
+				       unsigned int priority)
 {
+	INIT_LIST_HEAD(&shrink->head);
+	shrink->priority = priority;
 	shrink->do_shrink = func;
 }
 
@@ -110,19 +142,28 @@ static inline void ttm_mem_init_shrink(struct ttm_mem_shrink *shrink,
  * @glob: The struct ttm_mem_global object to register with.
  * @shrink: An initialized struct ttm_mem_shrink object to register.
  *
+ * The callback is inserted after all callbacks with the same or
+ * lower priority.
+ *
  * Returns:
- * -EBUSY: There's already a callback registered. (May change).
+ * -EBUSY: The callback is already registered.
  */
 
 static inline int ttm_mem_register_shrink(struct ttm_mem_global *glob,
 					  struct ttm_mem_shrink *shrink)
 {
+	struct ttm_mem_shrink *entry;
+
 	spin_lock(&glob->lock);
-	if (glob->shrink != NULL) {
+	if (!list_empty(&shrink->head)) {
 		spin_unlock(&glob->lock);
 		return -EBUSY;
 	}
-	glob->shrink = shrink;
+	list_for_each_entry(entry, &glob->shrink_list, head) {
+		if (entry->priority > shrink->priority)
+			break;
+	}
+	list_add_tail(&shrink->head, &entry->head);
 	spin_unlock(&glob->lock);
 	return 0;
 }
@@ -139,8 +180,8 @@ static inline void ttm_mem_unregister_shrink(struct ttm_mem_global *glob,
 					     struct ttm_mem_shrink *shrink)
 {
 	spin_lock(&glob->lock);
-	BUG_ON(glob->shrink != shrink);
-	glob->shrink = NULL;
+	BUG_ON(list_empty(&shrink->head));
+	list_del_init(&shrink->head);
 	spin_unlock(&glob->lock);
 }
 
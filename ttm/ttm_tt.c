@@ -171,36 +171,80 @@ int ttm_tt_populate(struct ttm_tt *ttm)
 EXPORT_SYMBOL(ttm_tt_populate);
 
 #ifdef CONFIG_X86
-static inline int ttm_tt_set_page_caching(struct page *p,
-					  enum ttm_caching_state c_old,
-					  enum ttm_caching_state c_new)
+static inline int ttm_tt_set_range_caching(struct page *p,
+					   unsigned long num_pages,
+					   enum ttm_caching_state c_old,
+					   enum ttm_caching_state c_new)
 {
+	unsigned long addr = (unsigned long) page_address(p);
 	int ret = 0;
 
-	if (PageHighMem(p))
-		return 0;
-
 	if (c_old != tt_cached) {
 		/* p isn't in the default caching state, set it to
 		 * writeback first to free its current memtype. */
 
-		ret = set_pages_wb(p, 1);
+		ret = set_memory_wb(addr, num_pages);
 		if (ret)
 			return ret;
 	}
 
 	if (c_new == tt_wc)
-		ret = set_memory_wc((unsigned long) page_address(p), 1);
+		ret = set_memory_wc(addr, num_pages);
 	else if (c_new == tt_uncached)
-		ret = set_pages_uc(p, 1);
+		ret = set_memory_uc(addr, num_pages);
 
 	return ret;
 }
+
+static inline bool ttm_tt_page_has_linear_map(struct page *p)
+{
+	return p != NULL && !PageHighMem(p);
+}
+
+/*
+ * Change the caching of pages [@start, @end) of @ttm, one physically
+ * contiguous run at a time, so that each run costs a single memtype
+ * reservation and TLB flush instead of one per page. On failure, @done
+ * is set to the start of the run that failed.
+ */
+static int ttm_tt_set_pages_caching(struct ttm_tt *ttm,
+				    unsigned long start, unsigned long end,
+				    enum ttm_caching_state c_old,
+				    enum ttm_caching_state c_new,
+				    unsigned long *done)
+{
+	unsigned long i, j;
+	int ret;
+
+	for (i = start; i < end; i = j) {
+		j = i + 1;
+		if (!ttm_tt_page_has_linear_map(ttm->pages[i]))
+			continue;
+
+		while (j < end && ttm_tt_page_has_linear_map(ttm->pages[j]) &&
+		       page_to_pfn(ttm->pages[j]) ==
+		       page_to_pfn(ttm->pages[j - 1]) + 1)
+			++j;
+
+		ret = ttm_tt_set_range_caching(ttm->pages[i], j - i,
+					       c_old, c_new);
+		if (unlikely(ret != 0)) {
+			*done = i;
+			return ret;
+		}
+	}
+
+	*done = end;
+	return 0;
+}
 #else /* CONFIG_X86 */
-static inline int ttm_tt_set_page_caching(struct page *p,
-					  enum ttm_caching_state c_old,
-					  enum ttm_caching_state c_new)
+static int ttm_tt_set_pages_caching(struct ttm_tt *ttm,
+				    unsigned long start, unsigned long end,
+				    enum ttm_caching_state c_old,
+				    enum ttm_caching_state c_new,
+				    unsigned long *done)
 {
+	*done = end;
 	return 0;
 }
 #endif /* CONFIG_X86 */
@@ -213,8 +257,7 @@ static inline int ttm_tt_set_page_caching(struct page *p,
 static int ttm_tt_set_caching(struct ttm_tt *ttm,
 			      enum ttm_caching_state c_state)
 {
-	int i, j;
-	struct page *cur_page;
+	unsigned long done, undone;
 	int ret;
 
 	if (ttm->caching_state == c_state)
@@ -229,29 +272,19 @@ static int ttm_tt_set_caching(struct ttm_tt *ttm,
 	if (ttm->caching_state == tt_cached)
 		drm_clflush_pages(ttm->pages, ttm->num_pages);
 
-	for (i = 0; i < ttm->num_pages; ++i) {
-		cur_page = ttm->pages[i];
-		if (likely(cur_page != NULL)) {
-			ret = ttm_tt_set_page_caching(cur_page,
-						      ttm->caching_state,
-						      c_state);
-			if (unlikely(ret != 0))
-				goto out_err;
-		}
-	}
+	ret = ttm_tt_set_pages_caching(ttm, 0, ttm->num_pages,
+				       ttm->caching_state, c_state, &done);
+	if (unlikely(ret != 0))
+		goto out_err;
 
 	ttm->caching_state = c_state;
+	atomic_inc(&ttm->glob->caching_changes);
 
 	return 0;
 
 out_err:
-	for (j = 0; j < i; ++j) {
-		cur_page = ttm->pages[j];
-		if (likely(cur_page != NULL)) {
-			(void)ttm_tt_set_page_caching(cur_page, c_state,
-						      ttm->caching_state);
-		}
-	}
+	(void) ttm_tt_set_pages_caching(ttm, 0, done, c_state,
+					ttm->caching_state, &undone);
 
 	return ret;
 }
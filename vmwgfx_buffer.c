@@ -320,7 +320,10 @@ struct ttm_bo_driver vmw_bo_driver = {
 	.sync_obj_flush = vmw_sync_obj_flush,
 	.sync_obj_unref = vmw_sync_obj_unref,
 	.sync_obj_ref = vmw_sync_obj_ref,
-	.move_notify = NULL,
+	.move_notify = &vmw_dmabuf_move_notify,
+	.quota_exceeded = &vmw_dmabuf_quota_exceeded,
+	.evict_prefer = &vmw_dmabuf_evict_prefer,
+	.evict_prefer_active = &vmw_dmabuf_evict_prefer_active,
 	.swap_notify = NULL,
 	.fault_reserve_notify = &vmw_ttm_fault_reserve_notify,
 	.io_mem_reserve = &vmw_ttm_io_mem_reserve,
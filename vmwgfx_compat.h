@@ -122,6 +122,15 @@ static inline struct timespec __vmw_timespec_sub(struct timespec t1,
 	set_memory_uc(_pa, _num)
 #endif
 
+/*
+ * flush_work
+ */
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(2,6,27))
+#undef flush_work
+#define flush_work(_work) \
+	flush_scheduled_work()
+#endif
+
 /*
  * shmem_file_setup
  */
@@ -297,6 +306,38 @@ static inline int vmwgfx_kref_sub(struct kref *kref, unsigned int count,
 #define kref_sub(_a, _b, _c) vmwgfx_kref_sub(_a, _b, _c)
 #endif
 
+/**
+ * schedule_hrtimeout
+ */
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,28))
+#define VMW_HAS_HRTIMEOUT
+#endif
+
+/**
+ * hrtimer expiry accessors
+ */
+
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(2,6,28))
+static inline void hrtimer_set_expires(struct hrtimer *timer, ktime_t time)
+{
+	timer->expires = time;
+}
+
+static inline ktime_t hrtimer_get_expires(const struct hrtimer *timer)
+{
+	return timer->expires;
+}
+#endif
+
+/**
+ * Trace events
+ */
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,32))
+#define VMW_HAS_TRACE_EVENTS
+#endif
+
 /**
  * kmap_atomic
  */
@@ -305,4 +346,23 @@ static inline int vmwgfx_kref_sub(struct kref *kref, unsigned int count,
 #define VMW_HAS_STACK_KMAP_ATOMIC
 #endif
 
+/**
+ * bitmap_set, bitmap_clear
+ */
+
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33))
+static inline void vmwgfx_bitmap_set(unsigned long *map, int start, int nr)
+{
+	while (nr--)
+		__set_bit(start++, map);
+}
+static inline void vmwgfx_bitmap_clear(unsigned long *map, int start, int nr)
+{
+	while (nr--)
+		__clear_bit(start++, map);
+}
+#define bitmap_set(_a, _b, _c) vmwgfx_bitmap_set(_a, _b, _c)
+#define bitmap_clear(_a, _b, _c) vmwgfx_bitmap_clear(_a, _b, _c)
+#endif
+
 #endif
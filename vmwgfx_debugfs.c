@@ -0,0 +1,136 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2011 VMware, Inc., Palo Alto, CA., USA
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#include "vmwgfx_drv.h"
+#include <linux/seq_file.h>
+
+#if defined(CONFIG_DEBUG_FS)
+
+#define VMW_IOCTL_NAME(_name) [DRM_VMW_ ## _name] = #_name
+
+static const char *vmw_ioctl_names[VMWGFX_NUM_IOCTLS] = {
+	VMW_IOCTL_NAME(GET_PARAM),
+	VMW_IOCTL_NAME(ALLOC_DMABUF),
+	VMW_IOCTL_NAME(UNREF_DMABUF),
+	VMW_IOCTL_NAME(CURSOR_BYPASS),
+	VMW_IOCTL_NAME(CONTROL_STREAM),
+	VMW_IOCTL_NAME(CLAIM_STREAM),
+	VMW_IOCTL_NAME(UNREF_STREAM),
+	VMW_IOCTL_NAME(CREATE_CONTEXT),
+	VMW_IOCTL_NAME(UNREF_CONTEXT),
+	VMW_IOCTL_NAME(CREATE_SURFACE),
+	VMW_IOCTL_NAME(UNREF_SURFACE),
+	VMW_IOCTL_NAME(REF_SURFACE),
+	VMW_IOCTL_NAME(EXECBUF),
+	VMW_IOCTL_NAME(GET_3D_CAP),
+	VMW_IOCTL_NAME(FENCE_WAIT),
+	VMW_IOCTL_NAME(FENCE_SIGNALED),
+	VMW_IOCTL_NAME(FENCE_UNREF),
+	VMW_IOCTL_NAME(FENCE_EVENT),
+};
+
+/**
+ * vmw_debugfs_ioctls - Show call counts and latency histograms of the
+ * driver ioctls.
+ *
+ * Histogram buckets are printed as the upper latency bound in
+ * nanoseconds followed by the number of calls, and only if non-empty.
+ */
+static int vmw_debugfs_ioctls(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = (struct drm_info_node *) m->private;
+	struct drm_device *dev = node->minor->dev;
+	struct vmw_private *dev_priv = vmw_priv(dev);
+	struct vmw_ioctl_stats sum;
+	unsigned int i, j;
+	int cpu;
+
+	if (dev_priv == NULL) {
+		seq_printf(m, "driver not loaded\n");
+		return 0;
+	}
+
+	seq_printf(m, "core ioctls: %lu, pending %ld\n",
+		   drm_ioctl_total(dev), drm_ioctl_pending(dev));
+
+	for (i = 0; i < VMWGFX_NUM_IOCTLS; ++i) {
+		memset(&sum, 0, sizeof(sum));
+		for_each_possible_cpu(cpu) {
+			struct vmw_ioctl_stats *stats =
+				&per_cpu_ptr(dev_priv->ioctl_stats,
+					     cpu)->ioctl[i];
+
+			sum.count += stats->count;
+			sum.time_ns += stats->time_ns;
+			for (j = 0; j < VMW_IOCTL_HIST_BUCKETS; ++j)
+				sum.hist[j] += stats->hist[j];
+		}
+
+		if (sum.count == 0)
+			continue;
+
+		seq_printf(m, "%-15s calls %llu avg %llu ns:",
+			   vmw_ioctl_names[i] ? vmw_ioctl_names[i] : "UNKNOWN",
+			   (unsigned long long) sum.count,
+			   (unsigned long long) div64_u64(sum.time_ns,
+							  sum.count));
+		for (j = 0; j < VMW_IOCTL_HIST_BUCKETS; ++j) {
+			if (sum.hist[j] == 0)
+				continue;
+			if (j == VMW_IOCTL_HIST_BUCKETS - 1)
+				seq_printf(m, " inf:%u", sum.hist[j]);
+			else
+				seq_printf(m, " %llu:%u", 1ULL << j,
+					   sum.hist[j]);
+		}
+		seq_printf(m, "\n");
+	}
+
+	return 0;
+}
+
+static struct drm_info_list vmw_debugfs_list[] = {
+	{"fb_defio", vmw_fb_debugfs_defio, 0},
+	{"ioctls", vmw_debugfs_ioctls, 0},
+	{"fifo", vmw_fifo_debugfs, 0},
+	{"clients", vmw_client_debugfs, 0},
+};
+
+#define VMW_DEBUGFS_ENTRIES ARRAY_SIZE(vmw_debugfs_list)
+
+int vmw_debugfs_init(struct drm_minor *minor)
+{
+	return drm_debugfs_create_files(vmw_debugfs_list, VMW_DEBUGFS_ENTRIES,
+					minor->debugfs_root, minor);
+}
+
+void vmw_debugfs_cleanup(struct drm_minor *minor)
+{
+	drm_debugfs_remove_files(vmw_debugfs_list, VMW_DEBUGFS_ENTRIES, minor);
+}
+
+#endif /* CONFIG_DEBUG_FS */
@@ -65,6 +65,13 @@
  *
  * DRM_VMW_PARAM_OVERLAY_IOCTL:
  * Does the driver support the overlay ioctl.
+ *
+ * DRM_VMW_PARAM_FIFO_LAG_US:
+ * Average time in microseconds from command submission to the
+ * corresponding fence being signaled.
+ *
+ * DRM_VMW_PARAM_FENCE_RATE:
+ * Average number of fences signaled per second.
  */
 
 #define DRM_VMW_PARAM_NUM_STREAMS      0
@@ -74,6 +81,8 @@
 #define DRM_VMW_PARAM_FIFO_CAPS        4
 #define DRM_VMW_PARAM_MAX_FB_SIZE      5
 #define DRM_VMW_PARAM_FIFO_HW_VERSION  6
+#define DRM_VMW_PARAM_FIFO_LAG_US      7
+#define DRM_VMW_PARAM_FENCE_RATE       8
 
 /**
  * struct drm_vmw_getparam_arg
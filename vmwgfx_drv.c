@@ -158,6 +158,11 @@ static struct pci_device_id vmw_pci_id_list[] = {
 
 static char *vmw_devname = "vmwgfx";
 static int enable_fbdev;
+int irq_moderation_us;
+int present_rate_hz = 60;
+int client_vram_quota;
+int client_gmr_quota;
+int client_mem_quota;
 #ifdef VMWGFX_STANDALONE
 static int force_stealth;
 int force_no_3d;
@@ -170,6 +175,16 @@ static int vmwgfx_pm_notifier(struct notifier_block *nb, unsigned long val,
 
 MODULE_PARM_DESC(enable_fbdev, "Enable vmwgfx fbdev");
 module_param_named(enable_fbdev, enable_fbdev, int, 0600);
+MODULE_PARM_DESC(irq_moderation_us, "Interrupt moderation window in us");
+module_param_named(irq_moderation_us, irq_moderation_us, int, 0600);
+MODULE_PARM_DESC(present_rate_hz, "Maximum rate of deferred screen updates");
+module_param_named(present_rate_hz, present_rate_hz, int, 0600);
+MODULE_PARM_DESC(client_vram_quota, "Per-client VRAM limit in MiB, 0 = none");
+module_param_named(client_vram_quota, client_vram_quota, int, 0600);
+MODULE_PARM_DESC(client_gmr_quota, "Per-client GMR page limit, 0 = none");
+module_param_named(client_gmr_quota, client_gmr_quota, int, 0600);
+MODULE_PARM_DESC(client_mem_quota, "Per-client buffer limit in MiB, 0 = none");
+module_param_named(client_mem_quota, client_mem_quota, int, 0600);
 
 #ifdef VMWGFX_STANDALONE
 MODULE_PARM_DESC(force_stealth, "Force stealth mode");
@@ -316,12 +331,25 @@ static int vmw_driver_load(struct drm_device *dev, unsigned long chipset)
 	idr_init(&dev_priv->context_idr);
 	idr_init(&dev_priv->surface_idr);
 	idr_init(&dev_priv->stream_idr);
+	spin_lock_init(&dev_priv->client_lock);
+	INIT_LIST_HEAD(&dev_priv->client_list);
 	mutex_init(&dev_priv->init_mutex);
 	init_waitqueue_head(&dev_priv->fence_queue);
 	init_waitqueue_head(&dev_priv->fifo_queue);
 	dev_priv->fence_queue_waiters = 0;
 	atomic_set(&dev_priv->fifo_queue_waiters, 0);
 
+	ret = vmw_fifo_stats_init(&dev_priv->fifo.stats);
+	if (unlikely(ret != 0))
+		goto out_err0;
+
+	BUILD_BUG_ON(ARRAY_SIZE(vmw_ioctls) > VMWGFX_NUM_IOCTLS);
+	dev_priv->ioctl_stats = alloc_percpu(struct vmw_ioctl_pcpu);
+	if (unlikely(dev_priv->ioctl_stats == NULL)) {
+		ret = -ENOMEM;
+		goto out_err0;
+	}
+
 	dev_priv->io_start = pci_resource_start(dev->pdev, 0);
 	dev_priv->vram_start = pci_resource_start(dev->pdev, 1);
 	dev_priv->mmio_start = pci_resource_start(dev->pdev, 2);
@@ -479,15 +507,19 @@ static int vmw_driver_load(struct drm_device *dev, unsigned long chipset)
 	dev_priv->fman = vmw_fence_manager_init(dev_priv);
 	if (unlikely(dev_priv->fman == NULL))
 		goto out_no_fman;
-	ret = vmw_kms_init(dev_priv);
-	if (unlikely(ret != 0))
-		goto out_no_kms;
-	vmw_overlay_init(dev_priv);
+
 	if (dev_priv->enable_fb) {
 		ret = vmw_3d_resource_inc(dev_priv, false);
 		if (unlikely(ret != 0))
 			goto out_no_fifo;
 		vmw_kms_save_vga(dev_priv);
+	}
+
+	ret = vmw_kms_init(dev_priv);
+	if (unlikely(ret != 0))
+		goto out_no_kms;
+	vmw_overlay_init(dev_priv);
+	if (dev_priv->enable_fb) {
 		vmw_fb_init(dev_priv);
 		DRM_INFO("%s", vmw_fifo_have_3d(dev_priv) ?
 			 "Detected device 3D availability.\n" :
@@ -514,15 +546,16 @@ static int vmw_driver_load(struct drm_device *dev, unsigned long chipset)
 	return 0;
 
 out_no_irq:
-	if (dev_priv->enable_fb) {
+	if (dev_priv->enable_fb)
 		vmw_fb_close(dev_priv);
+	vmw_overlay_close(dev_priv);
+	vmw_kms_close(dev_priv);
+out_no_kms:
+	if (dev_priv->enable_fb) {
 		vmw_kms_restore_vga(dev_priv);
 		vmw_3d_resource_dec(dev_priv, false);
 	}
 out_no_fifo:
-	vmw_overlay_close(dev_priv);
-	vmw_kms_close(dev_priv);
-out_no_kms:
 	vmw_fence_manager_takedown(dev_priv->fman);
 out_no_fman:
 	if (dev_priv->stealth)
@@ -547,6 +580,8 @@ out_err0:
 	idr_destroy(&dev_priv->surface_idr);
 	idr_destroy(&dev_priv->context_idr);
 	idr_destroy(&dev_priv->stream_idr);
+	free_percpu(dev_priv->ioctl_stats);
+	vmw_fifo_stats_takedown(&dev_priv->fifo.stats);
 	kfree(dev_priv);
 	return ret;
 }
@@ -588,12 +623,23 @@ static int vmw_driver_unload(struct drm_device *dev)
 	idr_destroy(&dev_priv->surface_idr);
 	idr_destroy(&dev_priv->context_idr);
 	idr_destroy(&dev_priv->stream_idr);
+	free_percpu(dev_priv->ioctl_stats);
+	vmw_fifo_stats_takedown(&dev_priv->fifo.stats);
 
 	kfree(dev_priv);
 
 	return 0;
 }
 
+static void vmw_preclose(struct drm_device *dev,
+			 struct drm_file *file_priv)
+{
+	struct vmw_fpriv *vmw_fp = vmw_fpriv(file_priv);
+	struct vmw_private *dev_priv = vmw_priv(dev);
+
+	vmw_event_fence_fpriv_gone(dev_priv->fman, &vmw_fp->fence_events);
+}
+
 static void vmw_postclose(struct drm_device *dev,
 			 struct drm_file *file_priv)
 {
@@ -601,6 +647,7 @@ static void vmw_postclose(struct drm_device *dev,
 
 	vmw_fp = vmw_fpriv(file_priv);
 	ttm_object_file_release(&vmw_fp->tfile);
+	vmw_client_unreference(&vmw_fp->client);
 	if (vmw_fp->locked_master)
 		drm_master_put(&vmw_fp->locked_master);
 	kfree(vmw_fp);
@@ -616,10 +663,16 @@ static int vmw_driver_open(struct drm_device *dev, struct drm_file *file_priv)
 	if (unlikely(vmw_fp == NULL))
 		return ret;
 
+	INIT_LIST_HEAD(&vmw_fp->fence_events);
+
 	vmw_fp->tfile = ttm_object_file_init(dev_priv->tdev, 10);
 	if (unlikely(vmw_fp->tfile == NULL))
 		goto out_no_tfile;
 
+	vmw_fp->client = vmw_client_alloc(dev_priv);
+	if (unlikely(vmw_fp->client == NULL))
+		goto out_no_client;
+
 	file_priv->driver_priv = vmw_fp;
 
 	if (unlikely(dev_priv->bdev.dev_mapping == NULL))
@@ -628,17 +681,46 @@ static int vmw_driver_open(struct drm_device *dev, struct drm_file *file_priv)
 
 	return 0;
 
+out_no_client:
+	ttm_object_file_release(&vmw_fp->tfile);
 out_no_tfile:
 	kfree(vmw_fp);
 	return ret;
 }
 
+/**
+ * vmw_ioctl_account - Record a driver ioctl call in the per-cpu statistics.
+ *
+ * @dev_priv: Pointer to the device private structure.
+ * @index: Driver ioctl number.
+ * @delta: Time spent in the ioctl.
+ */
+static void vmw_ioctl_account(struct vmw_private *dev_priv,
+			      unsigned int index, ktime_t delta)
+{
+	struct vmw_ioctl_stats *stats;
+	s64 ns = ktime_to_ns(delta);
+	unsigned int bucket;
+
+	if (ns < 0)
+		ns = 0;
+	bucket = min_t(unsigned int, fls64(ns), VMW_IOCTL_HIST_BUCKETS - 1);
+
+	stats = &per_cpu_ptr(dev_priv->ioctl_stats, get_cpu())->ioctl[index];
+	stats->count++;
+	stats->time_ns += ns;
+	stats->hist[bucket]++;
+	put_cpu();
+}
+
 static long vmw_unlocked_ioctl(struct file *filp, unsigned int cmd,
 			       unsigned long arg)
 {
 	struct drm_file *file_priv = filp->private_data;
 	struct drm_device *dev = file_priv->minor->dev;
 	unsigned int nr = DRM_IOCTL_NR(cmd);
+	ktime_t start;
+	long ret;
 
 	/*
 	 * Do extra checking on driver private ioctls.
@@ -662,6 +744,13 @@ static long vmw_unlocked_ioctl(struct file *filp, unsigned int cmd,
 			return -EINVAL;
 		}
 #endif
+
+		start = ktime_get();
+		ret = drm_ioctl(filp, cmd, arg);
+		vmw_ioctl_account(vmw_priv(dev), nr - DRM_COMMAND_BASE,
+				  ktime_sub(ktime_get(), start));
+
+		return ret;
 	}
 
 	return drm_ioctl(filp, cmd, arg);
@@ -1017,7 +1106,12 @@ static struct drm_driver driver = {
 	.irq_postinstall = vmw_irq_postinstall,
 	.irq_uninstall = vmw_irq_uninstall,
 	.irq_handler = vmw_irq_handler,
+#ifdef DRM_HAS_THREADED_IRQ
+	.irq_thread_fn = vmw_irq_thread_fn,
+#endif
 	.get_vblank_counter = vmw_get_vblank_counter,
+	.enable_vblank = vmw_enable_vblank,
+	.disable_vblank = vmw_disable_vblank,
 	.reclaim_buffers_locked = NULL,
 	.get_map_ofs = drm_core_get_map_ofs,
 	.get_reg_ofs = drm_core_get_reg_ofs,
@@ -1029,7 +1123,12 @@ static struct drm_driver driver = {
 	.master_set = vmw_master_set,
 	.master_drop = vmw_master_drop,
 	.open = vmw_driver_open,
+	.preclose = vmw_preclose,
 	.postclose = vmw_postclose,
+#if defined(CONFIG_DEBUG_FS)
+	.debugfs_init = vmw_debugfs_init,
+	.debugfs_cleanup = vmw_debugfs_cleanup,
+#endif
 	.fops = {
 		 .owner = THIS_MODULE,
 		 .open = drm_open,
@@ -1037,6 +1136,7 @@ static struct drm_driver driver = {
 		 .unlocked_ioctl = vmw_unlocked_ioctl,
 		 .mmap = vmw_mmap,
 		 .poll = drm_poll,
+		 .read = drm_read,
 		 .fasync = drm_fasync,
 #if defined(CONFIG_COMPAT)
 		 .compat_ioctl = drm_compat_ioctl,
@@ -33,6 +33,7 @@
 #include "vmwgfx_drm.h"
 #include "drm_hashtab.h"
 #include "linux/suspend.h"
+#include <linux/sched.h>
 #include "ttm/ttm_bo_driver.h"
 #include "ttm/ttm_object.h"
 #include "ttm/ttm_lock.h"
@@ -50,6 +51,8 @@
 #define VMWGFX_MAX_VALIDATIONS 2048
 #define VMWGFX_MAX_DISPLAYS 16
 #define VMWGFX_CMD_BOUNCE_INIT_SIZE 32768
+#define VMWGFX_NUM_IOCTLS (DRM_VMW_FENCE_EVENT + 1)
+#define VMW_IOCTL_HIST_BUCKETS 32
 
 #define VMW_PL_GMR TTM_PL_PRIV0
 #define VMW_PL_FLAG_GMR TTM_PL_FLAG_PRIV0
@@ -59,9 +62,41 @@
 #define VMW_RES_STREAM ttm_driver_type2
 #define VMW_RES_FENCE ttm_driver_type3
 
+/**
+ * struct vmw_client - Resource accounting for a single drm file.
+ *
+ * @kref: Refcount. Held by the file and by every object it created,
+ * so that objects outliving the file are still accounted.
+ * @head: List head for the vmw_private::client_list.
+ * @pid: Pid of the process that opened the file.
+ * @comm: Command name of that process.
+ * @num_contexts: Number of contexts created by this client.
+ * @num_surfaces: Number of surfaces created by this client.
+ * @num_dmabufs: Number of dma buffers created by this client.
+ * @dmabuf_pages: Total size of those dma buffers.
+ * @vram_pages: Pages of the client's dma buffers currently in VRAM.
+ * @gmr_pages: Pages of the client's dma buffers currently bound to GMRs.
+ */
+
+struct vmw_client {
+	struct kref kref;
+	struct vmw_private *dev_priv;
+	struct list_head head;
+	pid_t pid;
+	char comm[TASK_COMM_LEN];
+	atomic_t num_contexts;
+	atomic_t num_surfaces;
+	atomic_t num_dmabufs;
+	atomic_long_t dmabuf_pages;
+	atomic_long_t vram_pages;
+	atomic_long_t gmr_pages;
+};
+
 struct vmw_fpriv {
 	struct drm_master *locked_master;
 	struct ttm_object_file *tfile;
+	struct list_head fence_events;
+	struct vmw_client *client;
 };
 
 struct vmw_dma_buffer {
@@ -70,6 +105,8 @@ struct vmw_dma_buffer {
 	bool gmr_bound;
 	uint32_t cur_validate_node;
 	bool on_validate_list;
+	struct vmw_client *client;
+	uint32_t acct_mem_type;
 };
 
 struct vmw_resource {
@@ -111,10 +148,121 @@ struct vmw_surface {
 	struct vmw_cursor_snooper snooper;
 };
 
+#define VMW_MARKER_RING_SIZE 256
+#define VMW_FIFO_STAT_SLOTS 10
+#define VMW_FIFO_STAT_SLOT_NS 1000000000ULL
+#define VMW_FIFO_STAT_SLOT_JIFFIES HZ
+
+/**
+ * struct vmw_marker - Submission time of a seqno.
+ */
+
+struct vmw_marker {
+	uint32_t seqno;
+	u64 submitted;
+};
+
+/**
+ * struct vmw_marker_queue - Throttling and fence latency statistics.
+ *
+ * @ring: Markers, indexed by seqno modulo VMW_MARKER_RING_SIZE.
+ * @retired: Last seqno retired from the ring.
+ * @lag: Submit-to-retire time of the last retired marker, in ns.
+ * @lag_time: Time at which @lag was computed.
+ * @last_retire: Time at which markers were last retired.
+ * @avg_lag: Exponentially weighted average of @lag.
+ * @avg_interval: Exponentially weighted average time between retired
+ * markers.
+ * @lost: Unretired markers have been overwritten in the ring.
+ * @lost_seqno: Newest overwritten seqno.
+ * @lost_submitted: Submission time of the oldest overwritten marker.
+ * @lock: Protects the statistics and lost members, but not the ring.
+ */
+
 struct vmw_marker_queue {
-	struct list_head head;
-	struct timespec lag;
-	struct timespec lag_time;
+	struct vmw_marker ring[VMW_MARKER_RING_SIZE];
+	atomic_t retired;
+	u64 lag;
+	u64 lag_time;
+	u64 last_retire;
+	u64 avg_lag;
+	u64 avg_interval;
+	bool lost;
+	uint32_t lost_seqno;
+	u64 lost_submitted;
+	spinlock_t lock;
+};
+
+/**
+ * struct vmw_wait_backoff - State for the adaptive fallback waiter.
+ *
+ * @spin_end_ns: Monotonic time at which to stop busy-waiting.
+ * @sleep_ns: Length of the next sleep. Doubled after each sleep.
+ */
+
+struct vmw_wait_backoff {
+	s64 spin_end_ns;
+	u64 sleep_ns;
+};
+
+/**
+ * enum vmw_wait_reason - Why a submitter or waiter had to block,
+ * as reported by the vmw_wait trace event.
+ */
+
+enum vmw_wait_reason {
+	VMW_WAIT_FIFO_SPACE,
+	VMW_WAIT_SEQNO,
+	VMW_WAIT_SEQNO_POLL,
+	VMW_WAIT_FIFO_IDLE,
+	VMW_WAIT_LAG
+};
+
+/**
+ * enum vmw_fifo_stat - Event counters kept in struct vmw_fifo_stats.
+ */
+
+enum vmw_fifo_stat {
+	VMW_FIFO_STAT_RESERVES,
+	VMW_FIFO_STAT_BOUNCES,
+	VMW_FIFO_STAT_BYTES,
+	VMW_FIFO_STAT_WAITS,
+	VMW_FIFO_STAT_WAIT_NS,
+	VMW_FIFO_STAT_FENCES_SENT,
+	VMW_FIFO_STAT_FENCES_SIGNALED,
+	VMW_FIFO_STAT_NUM
+};
+
+/**
+ * struct vmw_fifo_stat_pcpu - Per-cpu fifo and fence counters, indexed
+ * by enum vmw_fifo_stat.
+ */
+
+struct vmw_fifo_stat_pcpu {
+	u64 count[VMW_FIFO_STAT_NUM];
+};
+
+/**
+ * struct vmw_fifo_stats - Fifo and fence counters with a rolling window.
+ *
+ * @pcpu: Running totals, kept per cpu so that updating them is lockless.
+ * @next_tick: Jiffies at which the current window slot is full.
+ * @slot_time: Start time of each window slot.
+ * @slot_count: Summed totals at the start of each window slot.
+ * @cur_slot: The slot currently being filled.
+ * @lock: Protects the window members. Only taken when a slot is full
+ * and when the statistics are read.
+ *
+ * Rates are computed over the last VMW_FIFO_STAT_SLOTS slots of
+ * VMW_FIFO_STAT_SLOT_NS each, by comparing the totals with the oldest slot.
+ */
+
+struct vmw_fifo_stats {
+	struct vmw_fifo_stat_pcpu *pcpu;
+	unsigned long next_tick;
+	u64 slot_time[VMW_FIFO_STAT_SLOTS];
+	u64 slot_count[VMW_FIFO_STAT_SLOTS][VMW_FIFO_STAT_NUM];
+	unsigned int cur_slot;
 	spinlock_t lock;
 };
 
@@ -128,6 +276,7 @@ struct vmw_fifo_state {
 	struct mutex fifo_mutex;
 	struct rw_semaphore rwsem;
 	struct vmw_marker_queue marker_queue;
+	struct vmw_fifo_stats stats;
 };
 
 struct vmw_relocation {
@@ -154,7 +303,32 @@ struct vmw_sw_context{
 	uint32_t num_ref_resources;
 };
 
+/**
+ * struct vmw_ioctl_stats - Call count and latency of a driver ioctl.
+ *
+ * @count: Number of calls.
+ * @time_ns: Total time spent in the ioctl.
+ * @hist: Calls by latency. Bucket n counts calls that took less than
+ * 2^n ns but at least 2^(n-1) ns; the last bucket takes all slower calls.
+ */
+
+struct vmw_ioctl_stats {
+	u64 count;
+	u64 time_ns;
+	u32 hist[VMW_IOCTL_HIST_BUCKETS];
+};
+
+/**
+ * struct vmw_ioctl_pcpu - Per-cpu ioctl statistics, indexed by
+ * driver ioctl number.
+ */
+
+struct vmw_ioctl_pcpu {
+	struct vmw_ioctl_stats ioctl[VMWGFX_NUM_IOCTLS];
+};
+
 struct vmw_legacy_display;
+struct vmw_screen_object_display;
 struct vmw_overlay;
 
 struct vmw_master {
@@ -210,12 +384,21 @@ struct vmw_private {
 
 	uint32_t num_displays;
 
+	/*
+	 * Cleared whenever anyone but the legacy display unit code
+	 * touches the mode or topology registers, forcing the next
+	 * ldu commit to reprogram everything.
+	 */
+
+	bool topology_valid;
+
 	/*
 	 * Framebuffer info.
 	 */
 
 	void *fb_info;
 	struct vmw_legacy_display *ldu_priv;
+	struct vmw_screen_object_display *sou_priv;
 	struct vmw_overlay *overlay_priv;
 
 	/*
@@ -227,6 +410,13 @@ struct vmw_private {
 	struct idr surface_idr;
 	struct idr stream_idr;
 
+	/*
+	 * Per-client accounting.
+	 */
+
+	spinlock_t client_lock;
+	struct list_head client_list;
+
 	/*
 	 * Block lastclose from racing with firstopen.
 	 */
@@ -251,8 +441,28 @@ struct vmw_private {
 	atomic_t fifo_queue_waiters;
 	uint32_t last_read_seqno;
 	spinlock_t irq_lock;
+	uint32_t irq_pending; /* Protected by irq_lock */
 	struct vmw_fence_manager *fman;
 
+	/*
+	 * Driver ioctl statistics, exported through debugfs.
+	 */
+
+	struct vmw_ioctl_pcpu *ioctl_stats;
+
+	/*
+	 * The alpha cursor currently defined on the host, identified by a
+	 * fingerprint of its image together with its size and hotspot.
+	 * Protected by the mode_config mutex.
+	 */
+
+	bool cursor_valid;
+	u64 cursor_hash;
+	uint32_t cursor_width;
+	uint32_t cursor_height;
+	uint32_t cursor_hotspot_x;
+	uint32_t cursor_hotspot_y;
+
 	/*
 	 * Device state
 	 */
@@ -324,6 +534,47 @@ static inline uint32_t vmw_read(struct vmw_private *dev_priv,
 	return val;
 }
 
+/**
+ * vmw_fingerprint - Compute a 64-bit content fingerprint of a buffer.
+ *
+ * @addr: The buffer, which must be 8-byte aligned.
+ * @size: Size of the buffer in bytes.
+ *
+ * Four independent multiply-xor lanes keep the main loop free of long
+ * dependency chains. Not cryptographically strong; only intended to
+ * detect unchanged content. Never returns zero, so zero can be used to
+ * mean "unknown".
+ */
+static inline u64 vmw_fingerprint(const void *addr, size_t size)
+{
+	const u64 *p = addr;
+	const u64 k = 0x9E3779B97F4A7C15ULL;
+	u64 h0 = 0x243F6A8885A308D3ULL ^ size;
+	u64 h1 = 0x13198A2E03707344ULL;
+	u64 h2 = 0xA4093822299F31D0ULL;
+	u64 h3 = 0x082EFA98EC4E6C89ULL;
+	size_t n = size / sizeof(*p);
+	const u8 *tail;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		h0 = (h0 ^ p[i]) * k;
+		h1 = (h1 ^ p[i + 1]) * k;
+		h2 = (h2 ^ p[i + 2]) * k;
+		h3 = (h3 ^ p[i + 3]) * k;
+	}
+	for (; i < n; ++i)
+		h0 = (h0 ^ p[i]) * k;
+	for (tail = (const u8 *) &p[n]; tail < (const u8 *) addr + size;
+	     ++tail)
+		h1 = (h1 ^ *tail) * k;
+
+	h0 ^= (h1 << 16 | h1 >> 48) ^ (h2 << 32 | h2 >> 32) ^
+		(h3 << 48 | h3 >> 16);
+
+	return (h0 != 0) ? h0 : 1;
+}
+
 int vmw_3d_resource_inc(struct vmw_private *dev_priv, bool unhide_svga);
 void vmw_3d_resource_dec(struct vmw_private *dev_priv, bool hide_svga);
 
@@ -396,6 +647,19 @@ extern int vmw_user_stream_lookup(struct vmw_private *dev_priv,
 				  struct ttm_object_file *tfile,
 				  uint32_t *inout_id,
 				  struct vmw_resource **out);
+extern struct vmw_client *vmw_client_alloc(struct vmw_private *dev_priv);
+extern struct vmw_client *vmw_client_reference(struct vmw_client *client);
+extern void vmw_client_unreference(struct vmw_client **p_client);
+extern void vmw_dmabuf_move_notify(struct ttm_buffer_object *bo,
+				   struct ttm_mem_reg *mem);
+extern bool vmw_dmabuf_quota_exceeded(struct ttm_buffer_object *bo,
+				      uint32_t mem_type);
+extern bool vmw_dmabuf_evict_prefer(struct ttm_buffer_object *bo);
+extern bool vmw_dmabuf_evict_prefer_active(struct ttm_bo_device *bdev,
+					   uint32_t mem_type);
+#if defined(CONFIG_DEBUG_FS)
+extern int vmw_client_debugfs(struct seq_file *m, void *data);
+#endif
 
 
 /**
@@ -422,6 +686,14 @@ extern int vmw_fifo_send_fence(struct vmw_private *dev_priv,
 extern void vmw_fifo_ping_host(struct vmw_private *dev_priv, uint32_t reason);
 extern bool vmw_fifo_have_3d(struct vmw_private *dev_priv);
 extern bool vmw_fifo_have_pitchlock(struct vmw_private *dev_priv);
+extern bool vmw_fifo_have_screen_object(struct vmw_private *dev_priv);
+extern int vmw_fifo_stats_init(struct vmw_fifo_stats *stats);
+extern void vmw_fifo_stats_takedown(struct vmw_fifo_stats *stats);
+extern void vmw_fifo_stat_add(struct vmw_fifo_stats *stats,
+			      enum vmw_fifo_stat stat, u64 value);
+#if defined(CONFIG_DEBUG_FS)
+extern int vmw_fifo_debugfs(struct seq_file *m, void *data);
+#endif
 
 /**
  * TTM glue - vmwgfx_ttm_glue.c
@@ -449,12 +721,19 @@ extern int vmw_dma_quiescent(struct drm_device *dev);
 
 extern int vmw_execbuf_ioctl(struct drm_device *dev, void *data,
 			     struct drm_file *file_priv);
+extern int vmw_execbuf_fence_commands(struct drm_file *file_priv,
+				      struct vmw_private *dev_priv,
+				      struct vmw_fence_obj **p_fence,
+				      uint32_t *p_handle);
 
 /**
  * IRQs and wating - vmwgfx_irq.c
  */
 
 extern irqreturn_t vmw_irq_handler(DRM_IRQ_ARGS);
+#ifdef DRM_HAS_THREADED_IRQ
+extern irqreturn_t vmw_irq_thread_fn(DRM_IRQ_ARGS);
+#endif
 extern int vmw_wait_seqno(struct vmw_private *dev_priv, bool lazy,
 			     uint32_t seqno, bool interruptible,
 			     unsigned long timeout);
@@ -473,13 +752,18 @@ extern void vmw_update_seqno(struct vmw_private *dev_priv,
 				struct vmw_fifo_state *fifo_state);
 extern void vmw_seqno_waiter_add(struct vmw_private *dev_priv);
 extern void vmw_seqno_waiter_remove(struct vmw_private *dev_priv);
+extern void vmw_wait_backoff_init(struct vmw_private *dev_priv,
+				  struct vmw_wait_backoff *backoff,
+				  bool lazy);
+extern void vmw_wait_backoff(struct vmw_wait_backoff *backoff);
 
 /**
  * Rudimentary fence-like objects currently used only for throttling -
  * vmwgfx_marker.c
  */
 
-extern void vmw_marker_queue_init(struct vmw_marker_queue *queue);
+extern void vmw_marker_queue_init(struct vmw_marker_queue *queue,
+				  uint32_t seqno);
 extern void vmw_marker_queue_takedown(struct vmw_marker_queue *queue);
 extern int vmw_marker_push(struct vmw_marker_queue *queue,
 			  uint32_t seqno);
@@ -487,6 +771,8 @@ extern int vmw_marker_pull(struct vmw_marker_queue *queue,
 			  uint32_t signaled_seqno);
 extern int vmw_wait_lag(struct vmw_private *dev_priv,
 			struct vmw_marker_queue *queue, uint32_t us);
+extern u64 vmw_marker_fence_latency(struct vmw_marker_queue *queue);
+extern u64 vmw_marker_fence_rate(struct vmw_marker_queue *queue);
 
 /**
  * Kernel framebuffer - vmwgfx_fb.c
@@ -496,6 +782,18 @@ int vmw_fb_init(struct vmw_private *vmw_priv);
 int vmw_fb_close(struct vmw_private *dev_priv);
 int vmw_fb_off(struct vmw_private *vmw_priv);
 int vmw_fb_on(struct vmw_private *vmw_priv);
+#if defined(CONFIG_DEBUG_FS)
+int vmw_fb_debugfs_defio(struct seq_file *m, void *data);
+#endif
+
+/**
+ * Debugfs - vmwgfx_debugfs.c
+ */
+
+#if defined(CONFIG_DEBUG_FS)
+int vmw_debugfs_init(struct drm_minor *minor);
+void vmw_debugfs_cleanup(struct drm_minor *minor);
+#endif
 
 /**
  * Kernel modesetting - vmwgfx_kms.c
@@ -520,6 +818,8 @@ bool vmw_kms_validate_mode_vram(struct vmw_private *dev_priv,
 				uint32_t pitch,
 				uint32_t height);
 u32 vmw_get_vblank_counter(struct drm_device *dev, int crtc);
+int vmw_enable_vblank(struct drm_device *dev, int crtc);
+void vmw_disable_vblank(struct drm_device *dev, int crtc);
 
 
 /**
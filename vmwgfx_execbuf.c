@@ -26,6 +26,7 @@
  **************************************************************************/
 
 #include "vmwgfx_drv.h"
+#include "vmwgfx_trace.h"
 #include "vmwgfx_reg.h"
 #include "ttm/ttm_bo_api.h"
 #include "ttm/ttm_placement.h"
@@ -814,6 +815,11 @@ int vmw_execbuf_ioctl(struct drm_device *dev, void *data,
 	ttm_eu_fence_buffer_objects(&sw_context->validate_nodes,
 				    (void *) fence);
 
+	trace_vmw_execbuf(sw_context->cid_valid ?
+			  sw_context->last_cid : SVGA3D_INVALID_ID,
+			  arg->command_size, sw_context->cur_val_buf,
+			  (fence != NULL) ? fence->seqno : 0);
+
 	vmw_clear_validations(sw_context);
 	mutex_unlock(&dev_priv->cmdbuf_mutex);
 
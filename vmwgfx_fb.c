@@ -31,8 +31,23 @@
 
 #include "ttm/ttm_placement.h"
 
+#include <linux/seq_file.h>
+
 #define VMW_DIRTY_DELAY (HZ / 30)
 
+/*
+ * The fbdev framebuffer is never larger than VMW_FB_MAX_DIM in either
+ * direction, and dirty state is tracked per VMW_FB_TILE_SIZE square tile.
+ */
+#define VMW_FB_MAX_DIM 2048
+#define VMW_FB_TILE_SHIFT 6
+#define VMW_FB_TILE_SIZE (1 << VMW_FB_TILE_SHIFT)
+#define VMW_FB_TILES_PER_ROW (VMW_FB_MAX_DIM >> VMW_FB_TILE_SHIFT)
+#define VMW_FB_MAX_TILES (VMW_FB_TILES_PER_ROW * VMW_FB_TILES_PER_ROW)
+
+/* Number of update rects emitted per fifo reservation. */
+#define VMW_FB_UPDATE_BATCH 16
+
 struct vmw_fb_par {
 #if (defined(VMWGFX_STANDALONE) && defined(VMWGFX_FB_DEFERRED))
 	/**
@@ -62,11 +77,17 @@ struct vmw_fb_par {
 	struct {
 		spinlock_t lock;
 		bool active;
-		unsigned x1;
-		unsigned y1;
-		unsigned x2;
-		unsigned y2;
+		DECLARE_BITMAP(tiles, VMW_FB_MAX_TILES);
 	} dirty;
+
+	/**
+	 * Fingerprints of the shadow pages as last flushed through deferred
+	 * I/O, zero meaning unknown. Protected by the dirty lock.
+	 */
+	u64 *page_hash;
+	unsigned num_pages;
+	unsigned long pages_checked;
+	unsigned long pages_skipped;
 };
 
 static int vmw_fb_setcolreg(unsigned regno, unsigned red, unsigned green,
@@ -166,6 +187,7 @@ static int vmw_fb_set_par(struct fb_info *info)
 	struct vmw_private *vmw_priv = par->vmw_priv;
 	int ret;
 
+	vmw_priv->topology_valid = false;
 	ret = vmw_kms_write_svga(vmw_priv, info->var.xres, info->var.yres,
 				 info->fix.line_length,
 				 par->bpp, par->depth);
@@ -207,20 +229,59 @@ static int vmw_fb_blank(int blank, struct fb_info *info)
  * Dirty code
  */
 
-static void vmw_fb_dirty_flush(struct vmw_fb_par *par)
+static void vmw_fb_emit_updates(struct vmw_private *vmw_priv,
+				struct drm_clip_rect *rects,
+				unsigned num_rects)
 {
-	struct vmw_private *vmw_priv = par->vmw_priv;
-	struct fb_info *info = vmw_priv->fb_info;
-	int stride = (info->fix.line_length / 4);
-	int *src = (int *)info->screen_base;
-	__le32 __iomem *vram_mem = par->bo_ptr;
-	unsigned long flags;
-	unsigned x, y, w, h;
-	int i, k;
 	struct {
 		uint32_t header;
 		SVGAFifoCmdUpdate body;
 	} *cmd;
+	unsigned i;
+
+	if (num_rects == 0)
+		return;
+
+	cmd = vmw_fifo_reserve(vmw_priv, sizeof(*cmd) * num_rects);
+	if (unlikely(cmd == NULL)) {
+		DRM_ERROR("Fifo reserve failed.\n");
+		return;
+	}
+
+	for (i = 0; i < num_rects; ++i) {
+		cmd[i].header = cpu_to_le32(SVGA_CMD_UPDATE);
+		cmd[i].body.x = cpu_to_le32(rects[i].x1);
+		cmd[i].body.y = cpu_to_le32(rects[i].y1);
+		cmd[i].body.width = cpu_to_le32(rects[i].x2 - rects[i].x1);
+		cmd[i].body.height = cpu_to_le32(rects[i].y2 - rects[i].y1);
+	}
+
+	vmw_fifo_commit(vmw_priv, sizeof(*cmd) * num_rects);
+}
+
+/**
+ * vmw_fb_dirty_flush - Copy dirty tiles to VRAM and notify the host.
+ *
+ * Horizontal runs of dirty tiles are extended downwards over following
+ * tile rows with the same run dirty, and each resulting rectangle is
+ * copied row by row and announced with a single SVGA_CMD_UPDATE.
+ */
+static void vmw_fb_dirty_flush(struct vmw_fb_par *par)
+{
+	struct vmw_private *vmw_priv = par->vmw_priv;
+	struct fb_info *info = vmw_priv->fb_info;
+	unsigned pitch = info->fix.line_length;
+	unsigned cpp = par->bpp / 8;
+	unsigned tiles_x = DIV_ROUND_UP(info->var.xres, VMW_FB_TILE_SIZE);
+	unsigned tiles_y = DIV_ROUND_UP(info->var.yres, VMW_FB_TILE_SIZE);
+	u8 *src = (u8 *)info->screen_base;
+	u8 __iomem *vram_mem = par->bo_ptr;
+	DECLARE_BITMAP(tiles, VMW_FB_MAX_TILES);
+	struct drm_clip_rect rects[VMW_FB_UPDATE_BATCH];
+	struct drm_clip_rect *rect;
+	unsigned num_rects = 0;
+	unsigned long flags;
+	unsigned tx, ty, tx_end, ty_end, y;
 
 	if (vmw_priv->suspended)
 		return;
@@ -230,35 +291,97 @@ static void vmw_fb_dirty_flush(struct vmw_fb_par *par)
 		spin_unlock_irqrestore(&par->dirty.lock, flags);
 		return;
 	}
-	x = par->dirty.x1;
-	y = par->dirty.y1;
-	w = min(par->dirty.x2, info->var.xres) - x;
-	h = min(par->dirty.y2, info->var.yres) - y;
-	par->dirty.x1 = par->dirty.x2 = 0;
-	par->dirty.y1 = par->dirty.y2 = 0;
+	bitmap_copy(tiles, par->dirty.tiles, VMW_FB_MAX_TILES);
+	bitmap_zero(par->dirty.tiles, VMW_FB_MAX_TILES);
 	spin_unlock_irqrestore(&par->dirty.lock, flags);
 
-	for (i = y * stride; i < info->fix.smem_len / 4; i += stride) {
-		for (k = i+x; k < i+x+w && k < info->fix.smem_len / 4; k++)
-			iowrite32(src[k], vram_mem + k);
+	for (ty = 0; ty < tiles_y; ++ty) {
+		unsigned base = ty * VMW_FB_TILES_PER_ROW;
+
+		tx = find_next_bit(tiles, base + tiles_x, base);
+		while (tx < base + tiles_x) {
+			tx_end = find_next_zero_bit(tiles, base + tiles_x, tx);
+
+			/* Grow the run downwards while the same span is dirty. */
+			for (ty_end = ty + 1; ty_end < tiles_y; ++ty_end) {
+				unsigned off = (ty_end - ty) * VMW_FB_TILES_PER_ROW;
+
+				if (find_next_zero_bit(tiles, tx_end + off, tx + off) <
+				    tx_end + off)
+					break;
+				bitmap_clear(tiles, tx + off, tx_end - tx);
+			}
+
+			rect = &rects[num_rects++];
+			rect->x1 = (tx - base) << VMW_FB_TILE_SHIFT;
+			rect->y1 = ty << VMW_FB_TILE_SHIFT;
+			rect->x2 = min_t(unsigned, (tx_end - base) <<
+					 VMW_FB_TILE_SHIFT, info->var.xres);
+			rect->y2 = min_t(unsigned, ty_end << VMW_FB_TILE_SHIFT,
+					 info->var.yres);
+
+			for (y = rect->y1; y < rect->y2; ++y) {
+				unsigned offset = y * pitch + rect->x1 * cpp;
+
+				memcpy_toio(vram_mem + offset, src + offset,
+					    (rect->x2 - rect->x1) * cpp);
+			}
+
+			if (num_rects == VMW_FB_UPDATE_BATCH) {
+				vmw_fb_emit_updates(vmw_priv, rects, num_rects);
+				num_rects = 0;
+			}
+
+			tx = find_next_bit(tiles, base + tiles_x, tx_end);
+		}
 	}
 
-#if 0
-	DRM_INFO("%s, (%u, %u) (%ux%u)\n", __func__, x, y, w, h);
-#endif
+	vmw_fb_emit_updates(vmw_priv, rects, num_rects);
+}
 
-	cmd = vmw_fifo_reserve(vmw_priv, sizeof(*cmd));
-	if (unlikely(cmd == NULL)) {
-		DRM_ERROR("Fifo reserve failed.\n");
+/**
+ * vmw_fb_dirty_mark_locked - Mark the tiles covering a rectangle dirty.
+ * Must be called with the dirty lock held.
+ */
+static void vmw_fb_dirty_mark_locked(struct vmw_fb_par *par,
+				     unsigned x1, unsigned y1,
+				     unsigned width, unsigned height)
+{
+	unsigned x2 = min(x1 + width, par->max_width);
+	unsigned y2 = min(y1 + height, par->max_height);
+	unsigned tx1, tx2, ty;
+
+	if (x1 >= x2 || y1 >= y2)
 		return;
-	}
 
-	cmd->header = cpu_to_le32(SVGA_CMD_UPDATE);
-	cmd->body.x = cpu_to_le32(x);
-	cmd->body.y = cpu_to_le32(y);
-	cmd->body.width = cpu_to_le32(w);
-	cmd->body.height = cpu_to_le32(h);
-	vmw_fifo_commit(vmw_priv, sizeof(*cmd));
+	tx1 = x1 >> VMW_FB_TILE_SHIFT;
+	tx2 = (x2 - 1) >> VMW_FB_TILE_SHIFT;
+	for (ty = y1 >> VMW_FB_TILE_SHIFT;
+	     ty <= (y2 - 1) >> VMW_FB_TILE_SHIFT; ++ty)
+		bitmap_set(par->dirty.tiles, ty * VMW_FB_TILES_PER_ROW + tx1,
+			   tx2 - tx1 + 1);
+}
+
+/**
+ * vmw_fb_page_hash_invalidate_locked - Forget the fingerprints of the
+ * pages backing scanlines [@y1, @y1 + @height), since they are about to be
+ * flushed through the tile path. Must be called with the dirty lock held.
+ */
+static void vmw_fb_page_hash_invalidate_locked(struct vmw_fb_par *par,
+					       struct fb_info *info,
+					       unsigned y1, unsigned height)
+{
+	unsigned long start = (unsigned long) y1 * info->fix.line_length;
+	unsigned long end = (unsigned long) (y1 + height) *
+		info->fix.line_length;
+	unsigned i;
+
+	if (par->page_hash == NULL || height == 0)
+		return;
+
+	for (i = start >> PAGE_SHIFT;
+	     i <= (end - 1) >> PAGE_SHIFT && i < par->num_pages; ++i)
+		par->page_hash[i] = 0;
 }
 
 static void vmw_fb_dirty_mark(struct vmw_fb_par *par,
@@ -267,39 +390,53 @@ static void vmw_fb_dirty_mark(struct vmw_fb_par *par,
 {
 	struct fb_info *info = par->vmw_priv->fb_info;
 	unsigned long flags;
-	unsigned x2 = x1 + width;
-	unsigned y2 = y1 + height;
+	bool was_clean;
 
-#if (defined(VMWGFX_STANDALONE) && defined(VMWGFX_FB_DEFERRED))
-	(void) info;
-#endif
 	spin_lock_irqsave(&par->dirty.lock, flags);
-	if (par->dirty.x1 == par->dirty.x2) {
-		par->dirty.x1 = x1;
-		par->dirty.y1 = y1;
-		par->dirty.x2 = x2;
-		par->dirty.y2 = y2;
-		/* if we are active start the dirty work
-		 * we share the work with the defio system */
-		if (par->dirty.active)
+	was_clean = bitmap_empty(par->dirty.tiles, VMW_FB_MAX_TILES);
+	vmw_fb_dirty_mark_locked(par, x1, y1, width, height);
+	vmw_fb_page_hash_invalidate_locked(par, info, y1, height);
+	/* if we are active start the dirty work
+	 * we share the work with the defio system */
+	if (was_clean && par->dirty.active)
 #if (defined(VMWGFX_STANDALONE) && defined(VMWGFX_FB_DEFERRED))
-			schedule_delayed_work(&par->def_par.deferred_work, VMW_DIRTY_DELAY);
+		schedule_delayed_work(&par->def_par.deferred_work, VMW_DIRTY_DELAY);
 #else
-			schedule_delayed_work(&info->deferred_work, VMW_DIRTY_DELAY);
+		schedule_delayed_work(&info->deferred_work, VMW_DIRTY_DELAY);
 #endif
-	} else {
-		if (x1 < par->dirty.x1)
-			par->dirty.x1 = x1;
-		if (y1 < par->dirty.y1)
-			par->dirty.y1 = y1;
-		if (x2 > par->dirty.x2)
-			par->dirty.x2 = x2;
-		if (y2 > par->dirty.y2)
-			par->dirty.y2 = y2;
-	}
 	spin_unlock_irqrestore(&par->dirty.lock, flags);
 }
 
+/**
+ * vmw_fb_dirty_mark_range_locked - Mark the tiles covering the byte range
+ * [@start, @end) of the shadow framebuffer dirty. Only the first and last
+ * scanlines of the range are partial. Must be called with the dirty lock
+ * held.
+ */
+static void vmw_fb_dirty_mark_range_locked(struct vmw_fb_par *par,
+					   struct fb_info *info,
+					   unsigned long start,
+					   unsigned long end)
+{
+	unsigned pitch = info->fix.line_length;
+	unsigned cpp = par->bpp / 8;
+	unsigned y1 = start / pitch;
+	unsigned y2 = (end - 1) / pitch;
+	unsigned x1 = (start % pitch) / cpp;
+	unsigned x2 = ((end - 1) % pitch) / cpp + 1;
+
+	if (y1 == y2) {
+		vmw_fb_dirty_mark_locked(par, x1, y1, x2 - x1, 1);
+		return;
+	}
+
+	vmw_fb_dirty_mark_locked(par, x1, y1, par->max_width - x1, 1);
+	if (y2 > y1 + 1)
+		vmw_fb_dirty_mark_locked(par, 0, y1 + 1, par->max_width,
+					 y2 - y1 - 1);
+	vmw_fb_dirty_mark_locked(par, 0, y2, x2, 1);
+}
+
 #if (defined(VMWGFX_STANDALONE) && defined(VMWGFX_FB_DEFERRED))
 static void vmw_deferred_io(struct vmw_fb_deferred_par *def_par,
 			    struct list_head *pagelist)
@@ -314,29 +451,32 @@ static void vmw_deferred_io(struct fb_info *info,
 {
 	struct vmw_fb_par *par = info->par;
 #endif
-	unsigned long start, end, min, max;
+	unsigned long start;
 	unsigned long flags;
 	struct page *page;
-	int y1, y2;
+	u64 hash;
+
+	/**
+	 * Skip pages whose content hasn't changed since they were last
+	 * flushed. Hashing is done under the dirty lock, so that a racing
+	 * fbcon update can't be hidden behind a stale fingerprint.
+	 */
 
-	min = ULONG_MAX;
-	max = 0;
 	list_for_each_entry(page, pagelist, lru) {
 		start = page->index << PAGE_SHIFT;
-		end = start + PAGE_SIZE - 1;
-		min = min(min, start);
-		max = max(max, end);
-	}
-
-	if (min < max) {
-		y1 = min / info->fix.line_length;
-		y2 = (max / info->fix.line_length) + 1;
+		if (start >= info->fix.smem_len)
+			continue;
 
 		spin_lock_irqsave(&par->dirty.lock, flags);
-		par->dirty.x1 = 0;
-		par->dirty.y1 = y1;
-		par->dirty.x2 = info->var.xres;
-		par->dirty.y2 = y2;
+		par->pages_checked++;
+		hash = vmw_fingerprint(info->screen_base + start, PAGE_SIZE);
+		if (par->page_hash[page->index] == hash) {
+			par->pages_skipped++;
+		} else {
+			par->page_hash[page->index] = hash;
+			vmw_fb_dirty_mark_range_locked(par, info, start,
+						       start + PAGE_SIZE);
+		}
 		spin_unlock_irqrestore(&par->dirty.lock, flags);
 	}
 
@@ -355,6 +495,35 @@ struct fb_deferred_io vmw_defio = {
 };
 #endif
 
+#if defined(CONFIG_DEBUG_FS)
+int vmw_fb_debugfs_defio(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = (struct drm_info_node *) m->private;
+	struct vmw_private *dev_priv = vmw_priv(node->minor->dev);
+	struct vmw_fb_par *par;
+	unsigned long checked, skipped;
+	unsigned long flags;
+
+	if (dev_priv == NULL || dev_priv->fb_info == NULL) {
+		seq_printf(m, "fbdev not enabled\n");
+		return 0;
+	}
+
+	par = dev_priv->fb_info->par;
+	spin_lock_irqsave(&par->dirty.lock, flags);
+	checked = par->pages_checked;
+	skipped = par->pages_skipped;
+	spin_unlock_irqrestore(&par->dirty.lock, flags);
+
+	seq_printf(m, "pages checked: %lu\n", checked);
+	seq_printf(m, "pages skipped: %lu\n", skipped);
+	seq_printf(m, "skip ratio:    %lu%%\n",
+		   (checked != 0) ? skipped * 100 / checked : 0);
+
+	return 0;
+}
+#endif
+
 /*
  * Draw code
  */
@@ -450,8 +619,8 @@ int vmw_fb_init(struct vmw_private *vmw_priv)
 	fb_depth = 24;
 
 	/* XXX As shouldn't these be as well. */
-	fb_width = min(vmw_priv->fb_max_width, (unsigned)2048);
-	fb_height = min(vmw_priv->fb_max_height, (unsigned)2048);
+	fb_width = min(vmw_priv->fb_max_width, (unsigned)VMW_FB_MAX_DIM);
+	fb_height = min(vmw_priv->fb_max_height, (unsigned)VMW_FB_MAX_DIM);
 
 	initial_width = min(fb_width, initial_width);
 	initial_height = min(fb_height, initial_height);
@@ -473,6 +642,7 @@ int vmw_fb_init(struct vmw_private *vmw_priv)
 	par->depth = fb_depth;
 	par->bpp = fb_bpp;
 	par->vmalloc = NULL;
+	par->page_hash = NULL;
 	par->max_width = fb_width;
 	par->max_height = fb_height;
 
@@ -485,6 +655,14 @@ int vmw_fb_init(struct vmw_private *vmw_priv)
 		goto err_free;
 	}
 
+	par->num_pages = PAGE_ALIGN(fb_size) >> PAGE_SHIFT;
+	par->page_hash = vmalloc(par->num_pages * sizeof(*par->page_hash));
+	if (unlikely(par->page_hash == NULL)) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+	memset(par->page_hash, 0, par->num_pages * sizeof(*par->page_hash));
+
 	ret = vmw_fb_create_bo(vmw_priv, fb_size, &par->vmw_bo);
 	if (unlikely(ret != 0))
 		goto err_free;
@@ -578,8 +756,7 @@ int vmw_fb_init(struct vmw_private *vmw_priv)
 	/*
 	 * Dirty & Deferred IO
 	 */
-	par->dirty.x1 = par->dirty.x2 = 0;
-	par->dirty.y1 = par->dirty.y2 = 0;
+	bitmap_zero(par->dirty.tiles, VMW_FB_MAX_TILES);
 	par->dirty.active = true;
 	spin_lock_init(&par->dirty.lock);
 #if (defined(VMWGFX_STANDALONE) && defined(VMWGFX_FB_DEFERRED))
@@ -606,6 +783,7 @@ err_aper:
 err_unref:
 	ttm_bo_unref((struct ttm_buffer_object **)&par->vmw_bo);
 err_free:
+	vfree(par->page_hash);
 	vfree(par->vmalloc);
 	framebuffer_release(info);
 	vmw_priv->fb_info = NULL;
@@ -634,6 +812,7 @@ int vmw_fb_close(struct vmw_private *vmw_priv)
 	ttm_bo_kunmap(&par->map);
 	ttm_bo_unref(&bo);
 
+	vfree(par->page_hash);
 	vfree(par->vmalloc);
 	framebuffer_release(info);
 
@@ -27,6 +27,7 @@
 
 #include "drmP.h"
 #include "vmwgfx_drv.h"
+#include "vmwgfx_trace.h"
 
 #define VMW_FENCE_WRAP (1 << 31)
 
@@ -131,7 +132,8 @@ void vmw_fence_manager_takedown(struct vmw_fence_manager *fman)
 	unsigned long irq_flags;
 	bool lists_empty;
 
-	(void) cancel_work_sync(&fman->work);
+	/* Run any pending action cleanups before checking the lists. */
+	flush_work(&fman->work);
 
 	spin_lock_irqsave(&fman->lock, irq_flags);
 	lists_empty = list_empty(&fman->fence_list) &&
@@ -160,6 +162,8 @@ static int vmw_fence_obj_init(struct vmw_fence_manager *fman,
 	kref_init(&fence->kref);
 	fence->destroy = destroy;
 	init_waitqueue_head(&fence->queue);
+	fence->submitted = ktime_get();
+	fence->pid = task_pid_nr(current);
 
 	spin_lock_irqsave(&fman->lock, irq_flags);
 	if (unlikely(fman->fifo_down)) {
@@ -225,25 +229,64 @@ void vmw_fences_update(struct vmw_fence_manager *fman, u32 seqno)
 	unsigned long flags;
 	struct vmw_fence_obj *fence, *next_fence;
 	struct list_head action_list;
+	ktime_t now = ktime_get();
+	unsigned int signaled = 0;
 
 	spin_lock_irqsave(&fman->lock, flags);
 	list_for_each_entry_safe(fence, next_fence, &fman->fence_list, head) {
 		if (seqno - fence->seqno < VMW_FENCE_WRAP) {
+			trace_vmw_fence_signaled(fence->seqno, fence->pid,
+				ktime_to_ns(ktime_sub(now, fence->submitted)));
+			++signaled;
 			list_del_init(&fence->head);
 			fence->signaled |= DRM_VMW_FENCE_FLAG_EXEC;
 			INIT_LIST_HEAD(&action_list);
 			list_splice_init(&fence->seq_passed_actions,
 					 &action_list);
 			vmw_fences_perform_actions(fman, &action_list);
-			wake_up_all(&fence->queue);
+			if (waitqueue_active(&fence->queue))
+				wake_up_all(&fence->queue);
 		}
 
 	}
 	if (!list_empty(&fman->cleanup_list))
 		(void) schedule_work(&fman->work);
+	if (signaled != 0)
+		vmw_fifo_stat_add(&fman->dev_priv->fifo.stats,
+				  VMW_FIFO_STAT_FENCES_SIGNALED, signaled);
 	spin_unlock_irqrestore(&fman->lock, flags);
 }
 
+/**
+ * vmw_fences_outstanding - Count fences that have not yet signaled.
+ *
+ * @fman: Pointer to a struct vmw_fence_manager.
+ * @oldest_seqno: Returns the seqno of the oldest unsignaled fence.
+ * @oldest_age: Returns the time in ns since that fence was submitted.
+ *
+ * Returns the number of fences on the fence list. @oldest_seqno and
+ * @oldest_age are only valid if that number is nonzero.
+ */
+unsigned int vmw_fences_outstanding(struct vmw_fence_manager *fman,
+				    u32 *oldest_seqno, u64 *oldest_age)
+{
+	struct vmw_fence_obj *fence;
+	unsigned int num = 0;
+	unsigned long irq_flags;
+
+	spin_lock_irqsave(&fman->lock, irq_flags);
+	list_for_each_entry(fence, &fman->fence_list, head) {
+		if (num++ == 0) {
+			*oldest_seqno = fence->seqno;
+			*oldest_age = ktime_to_ns(ktime_sub(ktime_get(),
+							    fence->submitted));
+		}
+	}
+	spin_unlock_irqrestore(&fman->lock, irq_flags);
+
+	return num;
+}
+
 
 bool vmw_fence_obj_signaled(struct vmw_fence_obj *fence,
 			    uint32_t flags)
@@ -492,7 +535,8 @@ void vmw_fence_fifo_down(struct vmw_fence_manager *fman)
 			list_splice_init(&fence->seq_passed_actions,
 					 &action_list);
 			vmw_fences_perform_actions(fman, &action_list);
-			wake_up_all(&fence->queue);
+			if (waitqueue_active(&fence->queue))
+				wake_up_all(&fence->queue);
 		}
 
 		spin_lock_irq(&fman->lock);
@@ -500,6 +544,8 @@ void vmw_fence_fifo_down(struct vmw_fence_manager *fman)
 		BUG_ON(!list_empty(&fence->head));
 		kref_put(&fence->kref, vmw_fence_obj_destroy_locked);
 	}
+	if (!list_empty(&fman->cleanup_list))
+		(void) schedule_work(&fman->work);
 	spin_unlock_irqrestore(&fman->lock, irq_flags);
 }
 
@@ -609,3 +655,209 @@ int vmw_fence_obj_unref_ioctl(struct drm_device *dev, void *data,
 					 arg->handle,
 					 TTM_REF_USAGE);
 }
+
+/**
+ * struct vmw_event_fence_action - fence action that delivers a drm event.
+ *
+ * @action: A struct vmw_fence_action to hook up to a fence.
+ * @fpriv_head: List head for the list of actions of a file.
+ * @event: The event to deliver. NULL if the file went away.
+ * @fence: A referenced pointer to the fence to keep it alive while the
+ * action is pending.
+ * @dev: Pointer to a struct drm_device so we can access the event stuff.
+ * @tv_sec: If non-null, the variable pointed to will be assigned
+ * current time tv_sec val when the fence signals.
+ * @tv_usec: Must be set if @tv_sec is set, and the variable pointed to will
+ * be assigned the current time tv_usec val when the fence signals.
+ * @sequence: If non-null, assigned the vblank count of @pipe when the
+ * fence signals.
+ */
+struct vmw_event_fence_action {
+	struct vmw_fence_action action;
+	struct list_head fpriv_head;
+
+	struct drm_pending_event *event;
+	struct vmw_fence_obj *fence;
+	struct drm_device *dev;
+
+	uint32_t *tv_sec;
+	uint32_t *tv_usec;
+	uint32_t *sequence;
+	int pipe;
+};
+
+/**
+ * vmw_event_fence_fpriv_gone - Remove references to struct drm_file objects
+ *
+ * @fman: Pointer to a struct vmw_fence_manager.
+ * @event_list: Pointer to linked list of struct vmw_event_fence_action
+ * objects with pending events.
+ *
+ * This function is called when the file the events were queued for is
+ * closing. Pending events are destroyed and the actions are left to
+ * clean up after themselves when their fences signal.
+ */
+void vmw_event_fence_fpriv_gone(struct vmw_fence_manager *fman,
+				struct list_head *event_list)
+{
+	struct vmw_event_fence_action *eaction;
+	struct drm_pending_event *event;
+	unsigned long irq_flags;
+
+	while (1) {
+		spin_lock_irqsave(&fman->lock, irq_flags);
+		if (list_empty(event_list))
+			goto out_unlock;
+		eaction = list_first_entry(event_list,
+					   struct vmw_event_fence_action,
+					   fpriv_head);
+		list_del_init(&eaction->fpriv_head);
+		event = eaction->event;
+		eaction->event = NULL;
+		spin_unlock_irqrestore(&fman->lock, irq_flags);
+		event->destroy(event);
+	}
+out_unlock:
+	spin_unlock_irqrestore(&fman->lock, irq_flags);
+}
+
+/**
+ * vmw_event_fence_action_seq_passed - Deliver the event.
+ *
+ * Called with the fence manager lock held and irqs disabled. Time-stamps
+ * the event and moves it to the file's event list.
+ */
+static void vmw_event_fence_action_seq_passed(struct vmw_fence_action *action)
+{
+	struct vmw_event_fence_action *eaction =
+		container_of(action, struct vmw_event_fence_action, action);
+	struct drm_device *dev = eaction->dev;
+	struct drm_pending_event *event = eaction->event;
+	struct drm_file *file_priv;
+
+	if (unlikely(event == NULL))
+		return;
+
+	file_priv = event->file_priv;
+	spin_lock(&dev->event_lock);
+
+	if (likely(eaction->tv_sec != NULL)) {
+		struct timeval tv;
+
+		do_gettimeofday(&tv);
+		*eaction->tv_sec = tv.tv_sec;
+		*eaction->tv_usec = tv.tv_usec;
+	}
+
+	if (eaction->sequence != NULL)
+		*eaction->sequence = drm_vblank_count(dev, eaction->pipe);
+
+	list_del_init(&eaction->fpriv_head);
+	list_add_tail(&eaction->event->link, &file_priv->event_list);
+	eaction->event = NULL;
+	wake_up_all(&file_priv->event_wait);
+	spin_unlock(&dev->event_lock);
+}
+
+/**
+ * vmw_event_fence_action_cleanup - Free the action.
+ *
+ * Called from the fence manager workqueue once the action has run.
+ */
+static void vmw_event_fence_action_cleanup(struct vmw_fence_action *action)
+{
+	struct vmw_event_fence_action *eaction =
+		container_of(action, struct vmw_event_fence_action, action);
+	struct vmw_fence_manager *fman = eaction->fence->fman;
+	unsigned long irq_flags;
+
+	spin_lock_irqsave(&fman->lock, irq_flags);
+	list_del_init(&eaction->fpriv_head);
+	spin_unlock_irqrestore(&fman->lock, irq_flags);
+
+	vmw_fence_obj_unreference(&eaction->fence);
+	kfree(eaction);
+}
+
+/**
+ * vmw_fence_obj_add_action - Add an action to a fence object.
+ *
+ * @fence: The fence object.
+ * @action: The action to add.
+ *
+ * If the fence has already signaled, the action is performed right away.
+ */
+static void vmw_fence_obj_add_action(struct vmw_fence_obj *fence,
+				     struct vmw_fence_action *action)
+{
+	struct vmw_fence_manager *fman = fence->fman;
+	unsigned long irq_flags;
+	struct list_head action_list;
+
+	spin_lock_irqsave(&fman->lock, irq_flags);
+	if (fence->signaled & DRM_VMW_FENCE_FLAG_EXEC) {
+		INIT_LIST_HEAD(&action_list);
+		list_add_tail(&action->head, &action_list);
+		vmw_fences_perform_actions(fman, &action_list);
+		(void) schedule_work(&fman->work);
+	} else
+		list_add_tail(&action->head, &fence->seq_passed_actions);
+	spin_unlock_irqrestore(&fman->lock, irq_flags);
+}
+
+/**
+ * vmw_event_fence_action_queue - Post an event for sending when a fence
+ * object seqno has passed.
+ *
+ * @file_priv: The file connection on which the event should be posted.
+ * @fence: The fence object on which to post the event.
+ * @event: Event to be posted. This event should've been alloced
+ * using k[mz]alloc, and should've been completely initialized.
+ * @tv_sec: If non-null, the variable pointed to will be assigned
+ * current time tv_sec val when the fence signals.
+ * @tv_usec: Must be set if @tv_sec is set, and the variable pointed to will
+ * be assigned the current time tv_usec val when the fence signals.
+ * @sequence: If non-null, assigned the vblank count of @pipe when the
+ * fence signals.
+ * @pipe: The crtc index to read the vblank count from.
+ *
+ * On success, the event is owned by the action and will be delivered or
+ * destroyed by it.
+ */
+int vmw_event_fence_action_queue(struct drm_file *file_priv,
+				 struct vmw_fence_obj *fence,
+				 struct drm_pending_event *event,
+				 uint32_t *tv_sec,
+				 uint32_t *tv_usec,
+				 uint32_t *sequence,
+				 int pipe)
+{
+	struct vmw_event_fence_action *eaction;
+	struct vmw_fence_manager *fman = fence->fman;
+	struct vmw_fpriv *vmw_fp = vmw_fpriv(file_priv);
+	unsigned long irq_flags;
+
+	eaction = kzalloc(sizeof(*eaction), GFP_KERNEL);
+	if (unlikely(eaction == NULL))
+		return -ENOMEM;
+
+	eaction->event = event;
+
+	eaction->action.seq_passed = vmw_event_fence_action_seq_passed;
+	eaction->action.cleanup = vmw_event_fence_action_cleanup;
+
+	eaction->fence = vmw_fence_obj_reference(fence);
+	eaction->dev = fman->dev_priv->dev;
+	eaction->tv_sec = tv_sec;
+	eaction->tv_usec = tv_usec;
+	eaction->sequence = sequence;
+	eaction->pipe = pipe;
+
+	spin_lock_irqsave(&fman->lock, irq_flags);
+	list_add_tail(&eaction->fpriv_head, &vmw_fp->fence_events);
+	spin_unlock_irqrestore(&fman->lock, irq_flags);
+
+	vmw_fence_obj_add_action(fence, &eaction->action);
+
+	return 0;
+}
@@ -54,6 +54,8 @@ struct vmw_fence_obj {
 	struct list_head seq_passed_actions;
 	void (*destroy)(struct vmw_fence_obj *fence);
 	wait_queue_head_t queue;
+	ktime_t submitted;
+	pid_t pid;
 };
 
 extern struct vmw_fence_manager *
@@ -69,6 +71,10 @@ vmw_fence_obj_reference(struct vmw_fence_obj *fence);
 extern void vmw_fences_update(struct vmw_fence_manager *fman,
 			      u32 sequence);
 
+extern unsigned int vmw_fences_outstanding(struct vmw_fence_manager *fman,
+					   u32 *oldest_seqno,
+					   u64 *oldest_age);
+
 extern bool vmw_fence_obj_signaled(struct vmw_fence_obj *fence,
 				   uint32_t flags);
 
@@ -102,4 +108,15 @@ extern int vmw_fence_obj_signaled_ioctl(struct drm_device *dev, void *data,
 
 extern int vmw_fence_obj_unref_ioctl(struct drm_device *dev, void *data,
 				     struct drm_file *file_priv);
+
+extern void vmw_event_fence_fpriv_gone(struct vmw_fence_manager *fman,
+				       struct list_head *event_list);
+
+extern int vmw_event_fence_action_queue(struct drm_file *file_priv,
+					struct vmw_fence_obj *fence,
+					struct drm_pending_event *event,
+					uint32_t *tv_sec,
+					uint32_t *tv_usec,
+					uint32_t *sequence,
+					int pipe);
 #endif /* _VMWGFX_FENCE_H_ */
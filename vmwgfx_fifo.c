@@ -26,8 +26,10 @@
  **************************************************************************/
 
 #include "vmwgfx_drv.h"
+#include "vmwgfx_trace.h"
 #include "drmP.h"
 #include "ttm/ttm_placement.h"
+#include <linux/seq_file.h>
 
 bool vmw_fifo_have_3d(struct vmw_private *dev_priv)
 {
@@ -73,6 +75,30 @@ bool vmw_fifo_have_pitchlock(struct vmw_private *dev_priv)
 	return false;
 }
 
+/**
+ * vmw_fifo_have_screen_object - Check for screen object support.
+ *
+ * @dev_priv: Pointer to device private.
+ *
+ * Reads the FIFO capabilities directly from FIFO memory, so that this
+ * can be called before the FIFO has been brought up, which is the case
+ * at load time when fbdev is disabled.
+ */
+bool vmw_fifo_have_screen_object(struct vmw_private *dev_priv)
+{
+	__le32 __iomem *fifo_mem = dev_priv->mmio_virt;
+	uint32_t caps;
+
+	if (!(dev_priv->capabilities & SVGA_CAP_EXTENDED_FIFO))
+		return false;
+
+	caps = ioread32(fifo_mem + SVGA_FIFO_CAPABILITIES);
+	if (caps & SVGA_FIFO_CAP_SCREEN_OBJECT)
+		return true;
+
+	return false;
+}
+
 int vmw_fifo_init(struct vmw_private *dev_priv, struct vmw_fifo_state *fifo)
 {
 	__le32 __iomem *fifo_mem = dev_priv->mmio_virt;
@@ -106,6 +132,10 @@ int vmw_fifo_init(struct vmw_private *dev_priv, struct vmw_fifo_state *fifo)
 	dev_priv->traces_state = vmw_read(dev_priv, SVGA_REG_TRACES);
 	vmw_write(dev_priv, SVGA_REG_ENABLE, 1);
 
+	/* Whatever cursor the host had defined is gone. */
+	dev_priv->cursor_valid = false;
+	dev_priv->topology_valid = false;
+
 	min = 4;
 	if (dev_priv->capabilities & SVGA_CAP_EXTENDED_FIFO)
 		min = vmw_read(dev_priv, SVGA_REG_MEM_REGS);
@@ -136,10 +166,153 @@ int vmw_fifo_init(struct vmw_private *dev_priv, struct vmw_fifo_state *fifo)
 
 	atomic_set(&dev_priv->marker_seq, dev_priv->last_read_seqno);
 	iowrite32(dev_priv->last_read_seqno, fifo_mem + SVGA_FIFO_FENCE);
-	vmw_marker_queue_init(&fifo->marker_queue);
+	vmw_marker_queue_init(&fifo->marker_queue, dev_priv->last_read_seqno);
 	return vmw_fifo_send_fence(dev_priv, &dummy);
 }
 
+/**
+ * vmw_fifo_stats_init - Initialize the fifo statistics.
+ *
+ * @stats: Pointer to the statistics struct.
+ */
+int vmw_fifo_stats_init(struct vmw_fifo_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->pcpu = alloc_percpu(struct vmw_fifo_stat_pcpu);
+	if (unlikely(stats->pcpu == NULL))
+		return -ENOMEM;
+
+	spin_lock_init(&stats->lock);
+	stats->slot_time[0] = ktime_to_ns(ktime_get());
+	stats->next_tick = jiffies + VMW_FIFO_STAT_SLOT_JIFFIES;
+
+	return 0;
+}
+
+/**
+ * vmw_fifo_stats_takedown - Free the fifo statistics.
+ *
+ * @stats: Pointer to the statistics struct.
+ */
+void vmw_fifo_stats_takedown(struct vmw_fifo_stats *stats)
+{
+	free_percpu(stats->pcpu);
+	stats->pcpu = NULL;
+}
+
+/**
+ * vmw_fifo_stats_sum - Sum the per-cpu counters.
+ *
+ * @stats: Pointer to the statistics struct.
+ * @count: Returns the totals, indexed by enum vmw_fifo_stat.
+ *
+ * Counters may be updated concurrently, so the totals are a snapshot
+ * that is only approximately consistent.
+ */
+static void vmw_fifo_stats_sum(struct vmw_fifo_stats *stats, u64 *count)
+{
+	unsigned int i;
+	int cpu;
+
+	memset(count, 0, sizeof(u64) * VMW_FIFO_STAT_NUM);
+	for_each_possible_cpu(cpu) {
+		struct vmw_fifo_stat_pcpu *pcpu = per_cpu_ptr(stats->pcpu, cpu);
+
+		for (i = 0; i < VMW_FIFO_STAT_NUM; ++i)
+			count[i] += pcpu->count[i];
+	}
+}
+
+/**
+ * vmw_fifo_stats_tick_locked - Advance the rolling window.
+ *
+ * @stats: Pointer to the statistics struct.
+ * @now: Current monotonic time in ns.
+ *
+ * Starts a new slot if the current one is full. If the window has been
+ * idle for longer than its full length, all slots are restarted so that
+ * the rates don't average over the idle period.
+ */
+static void vmw_fifo_stats_tick_locked(struct vmw_fifo_stats *stats, u64 now)
+{
+	unsigned int i;
+	u64 elapsed = now - stats->slot_time[stats->cur_slot];
+	u64 count[VMW_FIFO_STAT_NUM];
+
+	if (likely(elapsed < VMW_FIFO_STAT_SLOT_NS))
+		return;
+
+	stats->next_tick = jiffies + VMW_FIFO_STAT_SLOT_JIFFIES;
+	vmw_fifo_stats_sum(stats, count);
+
+	if (elapsed >= VMW_FIFO_STAT_SLOTS * VMW_FIFO_STAT_SLOT_NS) {
+		for (i = 0; i < VMW_FIFO_STAT_SLOTS; ++i) {
+			stats->slot_time[i] = now;
+			memcpy(stats->slot_count[i], count, sizeof(count));
+		}
+		return;
+	}
+
+	stats->cur_slot = (stats->cur_slot + 1) % VMW_FIFO_STAT_SLOTS;
+	stats->slot_time[stats->cur_slot] = now;
+	memcpy(stats->slot_count[stats->cur_slot], count, sizeof(count));
+}
+
+/**
+ * vmw_fifo_stats_tick - Advance the rolling window if a slot is full.
+ *
+ * @stats: Pointer to the statistics struct.
+ *
+ * Only compares jiffies unless a slot is full, which happens at most
+ * once every VMW_FIFO_STAT_SLOT_NS.
+ */
+static void vmw_fifo_stats_tick(struct vmw_fifo_stats *stats)
+{
+	unsigned long irq_flags;
+
+	if (likely(time_before(jiffies, ACCESS_ONCE(stats->next_tick))))
+		return;
+
+	spin_lock_irqsave(&stats->lock, irq_flags);
+	vmw_fifo_stats_tick_locked(stats, ktime_to_ns(ktime_get()));
+	spin_unlock_irqrestore(&stats->lock, irq_flags);
+}
+
+/**
+ * vmw_fifo_stat_add - Add to a fifo statistics counter.
+ *
+ * @stats: Pointer to the statistics struct.
+ * @stat: The counter to add to.
+ * @value: The amount to add.
+ *
+ * Each counter must either be updated from process context only, or
+ * only with interrupts disabled, so that updates on the same cpu don't
+ * interleave.
+ */
+void vmw_fifo_stat_add(struct vmw_fifo_stats *stats,
+		       enum vmw_fifo_stat stat, u64 value)
+{
+	per_cpu_ptr(stats->pcpu, get_cpu())->count[stat] += value;
+	put_cpu();
+	vmw_fifo_stats_tick(stats);
+}
+
+/**
+ * vmw_fifo_stat_wait - Account a wait for fifo space.
+ *
+ * @stats: Pointer to the statistics struct.
+ * @duration: Length of the wait in ns.
+ */
+static void vmw_fifo_stat_wait(struct vmw_fifo_stats *stats, u64 duration)
+{
+	u64 *count = per_cpu_ptr(stats->pcpu, get_cpu())->count;
+
+	count[VMW_FIFO_STAT_WAITS]++;
+	count[VMW_FIFO_STAT_WAIT_NS] += duration;
+	put_cpu();
+	vmw_fifo_stats_tick(stats);
+}
+
 void vmw_fifo_ping_host(struct vmw_private *dev_priv, uint32_t reason)
 {
 	__le32 __iomem *fifo_mem = dev_priv->mmio_virt;
@@ -203,9 +376,11 @@ static int vmw_fifo_wait_noirq(struct vmw_private *dev_priv,
 {
 	int ret = 0;
 	unsigned long end_jiffies = jiffies + timeout;
+	struct vmw_wait_backoff backoff;
 	DEFINE_WAIT(__wait);
 
 	DRM_INFO("Fifo wait noirq.\n");
+	vmw_wait_backoff_init(dev_priv, &backoff, false);
 
 	for (;;) {
 		prepare_to_wait(&dev_priv->fifo_queue, &__wait,
@@ -218,7 +393,7 @@ static int vmw_fifo_wait_noirq(struct vmw_private *dev_priv,
 			DRM_ERROR("SVGA device lockup.\n");
 			break;
 		}
-		schedule_timeout(1);
+		vmw_wait_backoff(&backoff);
 		if (interruptible && signal_pending(current)) {
 			ret = -ERESTARTSYS;
 			break;
@@ -236,14 +411,19 @@ static int vmw_fifo_wait(struct vmw_private *dev_priv,
 {
 	long ret = 1L;
 	unsigned long irq_flags;
+	ktime_t start;
+	u64 duration;
 
 	if (likely(!vmw_fifo_is_full(dev_priv, bytes)))
 		return 0;
 
+	start = ktime_get();
 	vmw_fifo_ping_host(dev_priv, SVGA_SYNC_FIFOFULL);
-	if (!(dev_priv->capabilities & SVGA_CAP_IRQMASK))
-		return vmw_fifo_wait_noirq(dev_priv, bytes,
-					   interruptible, timeout);
+	if (!(dev_priv->capabilities & SVGA_CAP_IRQMASK)) {
+		ret = vmw_fifo_wait_noirq(dev_priv, bytes,
+					  interruptible, timeout);
+		goto out_trace;
+	}
 
 	mutex_lock(&dev_priv->hw_mutex);
 	if (atomic_add_return(1, &dev_priv->fifo_queue_waiters) > 0) {
@@ -281,6 +461,11 @@ static int vmw_fifo_wait(struct vmw_private *dev_priv,
 	}
 	mutex_unlock(&dev_priv->hw_mutex);
 
+out_trace:
+	duration = ktime_to_ns(ktime_sub(ktime_get(), start));
+	vmw_fifo_stat_wait(&dev_priv->fifo.stats, duration);
+	trace_vmw_wait(VMW_WAIT_FIFO_SPACE, bytes, ret, duration);
+
 	return ret;
 }
 
@@ -344,6 +529,10 @@ void *vmw_fifo_reserve(struct vmw_private *dev_priv, uint32_t bytes)
 				if (reserveable)
 					iowrite32(bytes, fifo_mem +
 						  SVGA_FIFO_RESERVED);
+				vmw_fifo_stat_add(&fifo_state->stats,
+						  VMW_FIFO_STAT_RESERVES, 1);
+				trace_vmw_fifo_reserve(bytes, next_cmd, stop,
+						       min, max, false);
 				return fifo_mem + (next_cmd >> 2);
 			} else {
 				need_bounce = true;
@@ -352,6 +541,12 @@ void *vmw_fifo_reserve(struct vmw_private *dev_priv, uint32_t bytes)
 
 		if (need_bounce) {
 			fifo_state->using_bounce_buffer = true;
+			vmw_fifo_stat_add(&fifo_state->stats,
+					  VMW_FIFO_STAT_RESERVES, 1);
+			vmw_fifo_stat_add(&fifo_state->stats,
+					  VMW_FIFO_STAT_BOUNCES, 1);
+			trace_vmw_fifo_reserve(bytes, next_cmd, stop,
+					       min, max, true);
 			if (bytes < fifo_state->static_buffer_size)
 				return fifo_state->static_buffer;
 			else {
@@ -421,6 +616,8 @@ void vmw_fifo_commit(struct vmw_private *dev_priv, uint32_t bytes)
 	BUG_ON(bytes > fifo_state->reserved_size);
 
 	fifo_state->reserved_size = 0;
+	vmw_fifo_stat_add(&fifo_state->stats, VMW_FIFO_STAT_BYTES, bytes);
+	trace_vmw_fifo_commit(bytes, fifo_state->using_bounce_buffer);
 
 	if (fifo_state->using_bounce_buffer) {
 		if (reserveable)
@@ -483,6 +680,9 @@ int vmw_fifo_send_fence(struct vmw_private *dev_priv, uint32_t *seqno)
 		 */
 
 		vmw_fifo_commit(dev_priv, 0);
+		vmw_fifo_stat_add(&fifo_state->stats,
+				  VMW_FIFO_STAT_FENCES_SENT, 1);
+		trace_vmw_fence_send(*seqno, true);
 		return 0;
 	}
 
@@ -492,9 +692,126 @@ int vmw_fifo_send_fence(struct vmw_private *dev_priv, uint32_t *seqno)
 
 	iowrite32(*seqno, &cmd_fence->fence);
 	vmw_fifo_commit(dev_priv, bytes);
+	vmw_fifo_stat_add(&fifo_state->stats, VMW_FIFO_STAT_FENCES_SENT, 1);
+	trace_vmw_fence_send(*seqno, false);
 	(void) vmw_marker_push(&fifo_state->marker_queue, *seqno);
 	vmw_update_seqno(dev_priv, fifo_state);
 
 out_err:
 	return ret;
 }
+
+#if defined(CONFIG_DEBUG_FS)
+
+static const char *vmw_fifo_stat_names[VMW_FIFO_STAT_NUM] = {
+	[VMW_FIFO_STAT_RESERVES] = "reserves",
+	[VMW_FIFO_STAT_BOUNCES] = "bounces",
+	[VMW_FIFO_STAT_BYTES] = "bytes",
+	[VMW_FIFO_STAT_WAITS] = "space waits",
+	[VMW_FIFO_STAT_WAIT_NS] = "space wait ns",
+	[VMW_FIFO_STAT_FENCES_SENT] = "fences sent",
+	[VMW_FIFO_STAT_FENCES_SIGNALED] = "fences signaled",
+};
+
+/**
+ * vmw_fifo_debugfs - Dump fifo and fence state.
+ *
+ * Prints the fifo registers, the amount of command data the device has
+ * not yet consumed, seqno and marker queue state and the fifo counters
+ * with their totals and per-second rates over the rolling window.
+ */
+int vmw_fifo_debugfs(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = (struct drm_info_node *) m->private;
+	struct vmw_private *dev_priv = vmw_priv(node->minor->dev);
+	struct vmw_fifo_state *fifo;
+	struct vmw_fifo_stats *stats;
+	__le32 __iomem *fifo_mem;
+	u64 count[VMW_FIFO_STAT_NUM];
+	u64 base[VMW_FIFO_STAT_NUM];
+	uint32_t min, max, next_cmd, stop, in_flight;
+	uint32_t marker_seq, oldest_seqno;
+	unsigned int outstanding, oldest;
+	unsigned long irq_flags;
+	u64 now, window, oldest_age;
+	int i;
+
+	if (dev_priv == NULL || dev_priv->mmio_virt == NULL) {
+		seq_printf(m, "fifo not mapped\n");
+		return 0;
+	}
+
+	fifo = &dev_priv->fifo;
+	stats = &fifo->stats;
+	fifo_mem = dev_priv->mmio_virt;
+
+	min = ioread32(fifo_mem + SVGA_FIFO_MIN);
+	max = ioread32(fifo_mem + SVGA_FIFO_MAX);
+	next_cmd = ioread32(fifo_mem + SVGA_FIFO_NEXT_CMD);
+	stop = ioread32(fifo_mem + SVGA_FIFO_STOP);
+
+	if (next_cmd >= stop)
+		in_flight = next_cmd - stop;
+	else
+		in_flight = (max - stop) + (next_cmd - min);
+
+	seq_printf(m, "min 0x%08x max 0x%08x next_cmd 0x%08x stop 0x%08x\n",
+		   min, max, next_cmd, stop);
+	seq_printf(m, "bytes in flight: %u of %u\n", in_flight, max - min);
+
+	marker_seq = atomic_read(&dev_priv->marker_seq);
+	seq_printf(m, "marker_seq %u last_read_seqno %u behind %u\n",
+		   marker_seq, dev_priv->last_read_seqno,
+		   marker_seq - dev_priv->last_read_seqno);
+	seq_printf(m, "marker lag: %llu ns, retire rate: %llu/s\n",
+		   (unsigned long long)
+		   vmw_marker_fence_latency(&fifo->marker_queue),
+		   (unsigned long long)
+		   vmw_marker_fence_rate(&fifo->marker_queue));
+
+	if (dev_priv->fman != NULL) {
+		outstanding = vmw_fences_outstanding(dev_priv->fman,
+						     &oldest_seqno,
+						     &oldest_age);
+		seq_printf(m, "outstanding fences: %u", outstanding);
+		if (outstanding != 0)
+			seq_printf(m, ", oldest seqno %u age %llu ns",
+				   oldest_seqno,
+				   (unsigned long long) oldest_age);
+		seq_printf(m, "\n");
+	}
+
+	spin_lock_irqsave(&stats->lock, irq_flags);
+	now = ktime_to_ns(ktime_get());
+	vmw_fifo_stats_tick_locked(stats, now);
+	oldest = (stats->cur_slot + 1) % VMW_FIFO_STAT_SLOTS;
+	if (stats->slot_time[oldest] == 0)
+		oldest = 0;
+	window = now - stats->slot_time[oldest];
+	vmw_fifo_stats_sum(stats, count);
+	memcpy(base, stats->slot_count[oldest], sizeof(base));
+	spin_unlock_irqrestore(&stats->lock, irq_flags);
+
+	seq_printf(m, "window: %llu ms\n",
+		   (unsigned long long) div64_u64(window, 1000000ULL));
+	for (i = 0; i < VMW_FIFO_STAT_NUM; ++i) {
+		u64 rate = 0;
+
+		if (window != 0)
+			rate = div64_u64((count[i] - base[i]) * 1000ULL,
+					 div64_u64(window, 1000000ULL) + 1);
+		seq_printf(m, "%-16s %llu, %llu/s\n", vmw_fifo_stat_names[i],
+			   (unsigned long long) count[i],
+			   (unsigned long long) rate);
+	}
+
+	seq_printf(m, "bounce hit rate: %llu%%\n",
+		   (unsigned long long)
+		   ((count[VMW_FIFO_STAT_RESERVES] != 0) ?
+		    div64_u64(count[VMW_FIFO_STAT_BOUNCES] * 100,
+			      count[VMW_FIFO_STAT_RESERVES]) : 0));
+
+	return 0;
+}
+
+#endif
@@ -61,6 +61,18 @@ int vmw_getparam_ioctl(struct drm_device *dev, void *data,
 		param->value = ioread32(fifo_mem + SVGA_FIFO_3D_HWVERSION);
 		break;
 	}
+	case DRM_VMW_PARAM_FIFO_LAG_US:
+	{
+		u64 lag = vmw_marker_fence_latency(&dev_priv->fifo.marker_queue);
+
+		do_div(lag, 1000);
+		param->value = lag;
+		break;
+	}
+	case DRM_VMW_PARAM_FENCE_RATE:
+		param->value =
+			vmw_marker_fence_rate(&dev_priv->fifo.marker_queue);
+		break;
 	default:
 		DRM_ERROR("Illegal vmwgfx get param request: %d\n",
 			  param->param);
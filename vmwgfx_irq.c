@@ -27,37 +27,118 @@
 
 #include "drmP.h"
 #include "vmwgfx_drv.h"
+#include "vmwgfx_trace.h"
+#include <linux/hrtimer.h>
 
 #define VMW_FENCE_WRAP (1 << 24)
 
-irqreturn_t vmw_irq_handler(DRM_IRQ_ARGS)
+/*
+ * Limits for the adaptive fallback waiter, in nanoseconds.
+ */
+#define VMW_WAIT_SPIN_MAX_NS  (20ULL * 1000ULL)
+#define VMW_WAIT_SLEEP_MIN_NS (10ULL * 1000ULL)
+#define VMW_WAIT_SLEEP_MAX_NS ((u64) (1000000000ULL / HZ))
+
+/**
+ * Interrupt moderation window in microseconds. When non-zero, the
+ * bottom half waits this long before processing, so that interrupts
+ * arriving during the window are handled in a single pass.
+ */
+extern int irq_moderation_us;
+
+/**
+ * vmw_irq_process - Process accumulated interrupt status.
+ *
+ * @dev_priv: Pointer to the device private structure.
+ *
+ * Fetches and clears the status bits collected by the top half since
+ * the last call, reads the fence seqno once, updates all fences and
+ * wakes each wait queue at most once.
+ */
+static irqreturn_t vmw_irq_process(struct vmw_private *dev_priv)
 {
-	struct drm_device *dev = (struct drm_device *)arg;
-	struct vmw_private *dev_priv = vmw_priv(dev);
+	unsigned long irq_flags;
 	uint32_t status;
 
-	spin_lock(&dev_priv->irq_lock);
-	status = inl(dev_priv->io_start + VMWGFX_IRQSTATUS_PORT);
-	spin_unlock(&dev_priv->irq_lock);
+	spin_lock_irqsave(&dev_priv->irq_lock, irq_flags);
+	status = dev_priv->irq_pending;
+	dev_priv->irq_pending = 0;
+	spin_unlock_irqrestore(&dev_priv->irq_lock, irq_flags);
 
 	if (status & SVGA_IRQFLAG_ANY_FENCE) {
 		__le32 __iomem *fifo_mem = dev_priv->mmio_virt;
 		uint32_t seqno = ioread32(fifo_mem + SVGA_FIFO_FENCE);
 
+		trace_vmw_irq(status, seqno);
 		vmw_fences_update(dev_priv->fman, seqno);
-		wake_up_all(&dev_priv->fence_queue);
+		smp_mb();
+		if (waitqueue_active(&dev_priv->fence_queue))
+			wake_up_all(&dev_priv->fence_queue);
+	} else
+		trace_vmw_irq(status, 0);
+
+	if (status & SVGA_IRQFLAG_FIFO_PROGRESS) {
+		smp_mb();
+		if (waitqueue_active(&dev_priv->fifo_queue))
+			wake_up_all(&dev_priv->fifo_queue);
 	}
-	if (status & SVGA_IRQFLAG_FIFO_PROGRESS)
-		wake_up_all(&dev_priv->fifo_queue);
 
+	return IRQ_HANDLED;
+}
+
+/**
+ * vmw_irq_handler - Interrupt top half.
+ *
+ * Only acks the interrupt and records its status. The processing is
+ * done by vmw_irq_thread_fn(), or directly if the kernel lacks
+ * threaded interrupt handlers.
+ */
+irqreturn_t vmw_irq_handler(DRM_IRQ_ARGS)
+{
+	struct drm_device *dev = (struct drm_device *)arg;
+	struct vmw_private *dev_priv = vmw_priv(dev);
+	uint32_t status;
+
+	spin_lock(&dev_priv->irq_lock);
+	status = inl(dev_priv->io_start + VMWGFX_IRQSTATUS_PORT);
 	if (likely(status)) {
 		outl(status, dev_priv->io_start + VMWGFX_IRQSTATUS_PORT);
-		return IRQ_HANDLED;
+		dev_priv->irq_pending |= status;
 	}
+	spin_unlock(&dev_priv->irq_lock);
 
-	return IRQ_NONE;
+	if (unlikely(!status))
+		return IRQ_NONE;
+
+#ifdef DRM_HAS_THREADED_IRQ
+	return IRQ_WAKE_THREAD;
+#else
+	return vmw_irq_process(dev_priv);
+#endif
 }
 
+#ifdef DRM_HAS_THREADED_IRQ
+/**
+ * vmw_irq_thread_fn - Interrupt bottom half.
+ */
+irqreturn_t vmw_irq_thread_fn(DRM_IRQ_ARGS)
+{
+	struct drm_device *dev = (struct drm_device *)arg;
+	struct vmw_private *dev_priv = vmw_priv(dev);
+
+#ifdef VMW_HAS_HRTIMEOUT
+	if (irq_moderation_us > 0) {
+		ktime_t expires = ns_to_ktime((u64) irq_moderation_us * 1000);
+
+		__set_current_state(TASK_UNINTERRUPTIBLE);
+		(void) schedule_hrtimeout(&expires, HRTIMER_MODE_REL);
+	}
+#endif
+
+	return vmw_irq_process(dev_priv);
+}
+#endif
+
 static bool vmw_fifo_idle(struct vmw_private *dev_priv, uint32_t seqno)
 {
 	uint32_t busy;
@@ -111,6 +192,64 @@ bool vmw_seqno_passed(struct vmw_private *dev_priv,
 	return ret;
 }
 
+/**
+ * vmw_wait_backoff_init - Set up an adaptive fallback wait.
+ *
+ * @dev_priv: Pointer to the device private structure.
+ * @backoff: The backoff state to initialize.
+ * @lazy: Don't busy-wait, and start with longer sleeps.
+ *
+ * The spin time and initial sleep length are derived from the observed
+ * fence latency, so that short waits are caught while spinning and
+ * longer waits don't wake up much more often than needed.
+ */
+void vmw_wait_backoff_init(struct vmw_private *dev_priv,
+			   struct vmw_wait_backoff *backoff,
+			   bool lazy)
+{
+	u64 latency = vmw_marker_fence_latency(&dev_priv->fifo.marker_queue);
+	u64 spin_ns = (lazy) ? 0ULL :
+		min_t(u64, latency >> 2, VMW_WAIT_SPIN_MAX_NS);
+
+	backoff->spin_end_ns = ktime_to_ns(ktime_get()) + (s64) spin_ns;
+	backoff->sleep_ns = latency >> ((lazy) ? 1 : 3);
+	backoff->sleep_ns = max_t(u64, backoff->sleep_ns,
+				  VMW_WAIT_SLEEP_MIN_NS);
+	backoff->sleep_ns = min_t(u64, backoff->sleep_ns,
+				  VMW_WAIT_SLEEP_MAX_NS);
+}
+
+/**
+ * vmw_wait_backoff - Wait a little before rechecking a wait condition.
+ *
+ * @backoff: The backoff state.
+ *
+ * Busy-waits until the spin time has passed. After that, sleeps for an
+ * exponentially increasing time, capped at one jiffy. The caller is
+ * expected to have set the task state, and a wake-up on the wait queue
+ * the caller is on will cut the sleep short.
+ */
+void vmw_wait_backoff(struct vmw_wait_backoff *backoff)
+{
+#ifdef VMW_HAS_HRTIMEOUT
+	ktime_t expires;
+#endif
+
+	if (ktime_to_ns(ktime_get()) < backoff->spin_end_ns) {
+		cpu_relax();
+		return;
+	}
+
+#ifdef VMW_HAS_HRTIMEOUT
+	expires = ns_to_ktime(backoff->sleep_ns);
+	(void) schedule_hrtimeout(&expires, HRTIMER_MODE_REL);
+#else
+	(void) schedule_timeout(1);
+#endif
+	backoff->sleep_ns = min_t(u64, backoff->sleep_ns << 1,
+				  VMW_WAIT_SLEEP_MAX_NS);
+}
+
 int vmw_fallback_wait(struct vmw_private *dev_priv,
 		      bool lazy,
 		      bool fifo_idle,
@@ -119,12 +258,13 @@ int vmw_fallback_wait(struct vmw_private *dev_priv,
 		      unsigned long timeout)
 {
 	struct vmw_fifo_state *fifo_state = &dev_priv->fifo;
+	struct vmw_wait_backoff backoff;
 
-	uint32_t count = 0;
 	uint32_t signal_seq;
 	int ret;
 	unsigned long end_jiffies = jiffies + timeout;
 	bool (*wait_condition)(struct vmw_private *, uint32_t);
+	ktime_t start = ktime_get();
 	DEFINE_WAIT(__wait);
 
 	wait_condition = (fifo_idle) ? &vmw_fifo_idle :
@@ -139,6 +279,13 @@ int vmw_fallback_wait(struct vmw_private *dev_priv,
 	signal_seq = atomic_read(&dev_priv->marker_seq);
 	ret = 0;
 
+	/**
+	 * Don't busy-wait on fifo idle, since checking it
+	 * means a register read.
+	 */
+
+	vmw_wait_backoff_init(dev_priv, &backoff, lazy || fifo_idle);
+
 	for (;;) {
 		prepare_to_wait(&dev_priv->fence_queue, &__wait,
 				(interruptible) ?
@@ -149,20 +296,7 @@ int vmw_fallback_wait(struct vmw_private *dev_priv,
 			DRM_ERROR("SVGA device lockup.\n");
 			break;
 		}
-		if (lazy)
-			schedule_timeout(1);
-		else if ((++count & 0x0F) == 0) {
-			/**
-			 * FIXME: Use schedule_hr_timeout here for
-			 * newer kernels and lower CPU utilization.
-			 */
-
-			__set_current_state(TASK_RUNNING);
-			schedule();
-			__set_current_state((interruptible) ?
-					    TASK_INTERRUPTIBLE :
-					    TASK_UNINTERRUPTIBLE);
-		}
+		vmw_wait_backoff(&backoff);
 		if (interruptible && signal_pending(current)) {
 			ret = -ERESTARTSYS;
 			break;
@@ -177,6 +311,9 @@ int vmw_fallback_wait(struct vmw_private *dev_priv,
 	if (fifo_idle)
 		up_read(&fifo_state->rwsem);
 
+	trace_vmw_wait(fifo_idle ? VMW_WAIT_FIFO_IDLE : VMW_WAIT_SEQNO_POLL,
+		       seqno, ret, ktime_to_ns(ktime_sub(ktime_get(), start)));
+
 	return ret;
 }
 
@@ -218,6 +355,7 @@ int vmw_wait_seqno(struct vmw_private *dev_priv,
 {
 	long ret;
 	struct vmw_fifo_state *fifo = &dev_priv->fifo;
+	ktime_t start;
 
 	if (likely(dev_priv->last_read_seqno - seqno < VMW_FENCE_WRAP))
 		return 0;
@@ -235,6 +373,7 @@ int vmw_wait_seqno(struct vmw_private *dev_priv,
 		return vmw_fallback_wait(dev_priv, lazy, false, seqno,
 					 interruptible, timeout);
 
+	start = ktime_get();
 	vmw_seqno_waiter_add(dev_priv);
 
 	if (interruptible)
@@ -255,6 +394,9 @@ int vmw_wait_seqno(struct vmw_private *dev_priv,
 	else if (likely(ret > 0))
 		ret = 0;
 
+	trace_vmw_wait(VMW_WAIT_SEQNO, seqno, ret,
+		       ktime_to_ns(ktime_sub(ktime_get(), start)));
+
 	return ret;
 }
 
@@ -267,6 +409,7 @@ void vmw_irq_preinstall(struct drm_device *dev)
 		return;
 
 	spin_lock_init(&dev_priv->irq_lock);
+	dev_priv->irq_pending = 0;
 	status = inl(dev_priv->io_start + VMWGFX_IRQSTATUS_PORT);
 	outl(status, dev_priv->io_start + VMWGFX_IRQSTATUS_PORT);
 }
@@ -27,8 +27,30 @@
 
 #include "vmwgfx_kms.h"
 
+/**
+ * Upper bound on the rate, in Hz, at which deferred damage is flushed to
+ * the host. Values <= 0 mean flush on every timer tick.
+ */
+extern int present_rate_hz;
+
 /* Might need a hrtimer here? */
-#define VMWGFX_PRESENT_RATE ((HZ / 60 > 0) ? HZ / 60 : 1)
+#define VMWGFX_PRESENT_RATE \
+	((present_rate_hz > 0 && HZ / present_rate_hz > 0) ? \
+	 HZ / present_rate_hz : 1)
+
+/*
+ * Maximum number of rectangles kept in a damage accumulator, and the
+ * estimated host overhead of a single update rectangle, expressed as a
+ * number of pixels. Two rectangles are merged whenever the extra area
+ * covered by their union is smaller than that overhead.
+ */
+#define VMW_DAMAGE_MAX_RECTS 16
+#define VMW_DAMAGE_RECT_COST 4096
+
+struct vmw_damage {
+	struct drm_clip_rect rects[VMW_DAMAGE_MAX_RECTS];
+	unsigned num_rects;
+};
 
 static int vmw_surface_dmabuf_pin(struct vmw_framebuffer *vfb);
 static int vmw_surface_dmabuf_unpin(struct vmw_framebuffer *vfb);
@@ -39,6 +61,7 @@ void vmw_display_unit_cleanup(struct vmw_display_unit *du)
 		vmw_surface_unreference(&du->cursor_surface);
 	if (du->cursor_dmabuf)
 		vmw_dmabuf_unreference(&du->cursor_dmabuf);
+	vmw_du_vblank_cleanup(du);
 	drm_crtc_cleanup(&du->crtc);
 	drm_encoder_cleanup(&du->encoder);
 	drm_connector_cleanup(&du->connector);
@@ -58,10 +81,26 @@ int vmw_cursor_update_image(struct vmw_private *dev_priv,
 	} *cmd;
 	u32 image_size = width * height * 4;
 	u32 cmd_size = sizeof(*cmd) + image_size;
+	u64 hash;
 
 	if (!image)
 		return -EINVAL;
 
+	/*
+	 * Toolkits keep re-selecting the same few shapes, and every display
+	 * unit redefines the single host cursor. Skip the upload if the host
+	 * already holds this exact image and hotspot.
+	 */
+
+	hash = vmw_fingerprint(image, image_size);
+	if (dev_priv->cursor_valid &&
+	    dev_priv->cursor_hash == hash &&
+	    dev_priv->cursor_width == width &&
+	    dev_priv->cursor_height == height &&
+	    dev_priv->cursor_hotspot_x == hotspotX &&
+	    dev_priv->cursor_hotspot_y == hotspotY)
+		return 0;
+
 	cmd = vmw_fifo_reserve(dev_priv, cmd_size);
 	if (unlikely(cmd == NULL)) {
 		DRM_ERROR("Fifo reserve failed.\n");
@@ -81,6 +120,13 @@ int vmw_cursor_update_image(struct vmw_private *dev_priv,
 
 	vmw_fifo_commit(dev_priv, cmd_size);
 
+	dev_priv->cursor_valid = true;
+	dev_priv->cursor_hash = hash;
+	dev_priv->cursor_width = width;
+	dev_priv->cursor_height = height;
+	dev_priv->cursor_hotspot_x = hotspotX;
+	dev_priv->cursor_hotspot_y = hotspotY;
+
 	return 0;
 }
 
@@ -198,6 +244,212 @@ int vmw_du_crtc_cursor_move(struct drm_crtc *crtc, int x, int y)
 	return 0;
 }
 
+/*
+ * Display Unit Connector functions
+ */
+
+enum drm_connector_status
+vmw_du_connector_detect(struct drm_connector *connector)
+{
+	uint32_t num_displays;
+	struct drm_device *dev = connector->dev;
+	struct vmw_private *dev_priv = vmw_priv(dev);
+
+	mutex_lock(&dev_priv->hw_mutex);
+	num_displays = vmw_read(dev_priv, SVGA_REG_NUM_DISPLAYS);
+	mutex_unlock(&dev_priv->hw_mutex);
+
+	return ((vmw_connector_to_du(connector)->unit < num_displays) ?
+		connector_status_connected : connector_status_disconnected);
+}
+
+static struct drm_display_mode vmw_kms_connector_builtin[] = {
+	/* 640x480@60Hz */
+	{ DRM_MODE("640x480", DRM_MODE_TYPE_DRIVER, 25175, 640, 656,
+		   752, 800, 0, 480, 489, 492, 525, 0,
+		   DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_NVSYNC) },
+	/* 800x600@60Hz */
+	{ DRM_MODE("800x600", DRM_MODE_TYPE_DRIVER, 40000, 800, 840,
+		   968, 1056, 0, 600, 601, 605, 628, 0,
+		   DRM_MODE_FLAG_PHSYNC | DRM_MODE_FLAG_PVSYNC) },
+	/* 1024x768@60Hz */
+	{ DRM_MODE("1024x768", DRM_MODE_TYPE_DRIVER, 65000, 1024, 1048,
+		   1184, 1344, 0, 768, 771, 777, 806, 0,
+		   DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_NVSYNC) },
+	/* 1152x864@75Hz */
+	{ DRM_MODE("1152x864", DRM_MODE_TYPE_DRIVER, 108000, 1152, 1216,
+		   1344, 1600, 0, 864, 865, 868, 900, 0,
+		   DRM_MODE_FLAG_PHSYNC | DRM_MODE_FLAG_PVSYNC) },
+	/* 1280x768@60Hz */
+	{ DRM_MODE("1280x768", DRM_MODE_TYPE_DRIVER, 79500, 1280, 1344,
+		   1472, 1664, 0, 768, 771, 778, 798, 0,
+		   DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_PVSYNC) },
+	/* 1280x800@60Hz */
+	{ DRM_MODE("1280x800", DRM_MODE_TYPE_DRIVER, 83500, 1280, 1352,
+		   1480, 1680, 0, 800, 803, 809, 831, 0,
+		   DRM_MODE_FLAG_PHSYNC | DRM_MODE_FLAG_NVSYNC) },
+	/* 1280x960@60Hz */
+	{ DRM_MODE("1280x960", DRM_MODE_TYPE_DRIVER, 108000, 1280, 1376,
+		   1488, 1800, 0, 960, 961, 964, 1000, 0,
+		   DRM_MODE_FLAG_PHSYNC | DRM_MODE_FLAG_PVSYNC) },
+	/* 1280x1024@60Hz */
+	{ DRM_MODE("1280x1024", DRM_MODE_TYPE_DRIVER, 108000, 1280, 1328,
+		   1440, 1688, 0, 1024, 1025, 1028, 1066, 0,
+		   DRM_MODE_FLAG_PHSYNC | DRM_MODE_FLAG_PVSYNC) },
+	/* 1360x768@60Hz */
+	{ DRM_MODE("1360x768", DRM_MODE_TYPE_DRIVER, 85500, 1360, 1424,
+		   1536, 1792, 0, 768, 771, 777, 795, 0,
+		   DRM_MODE_FLAG_PHSYNC | DRM_MODE_FLAG_PVSYNC) },
+	/* 1440x1050@60Hz */
+	{ DRM_MODE("1400x1050", DRM_MODE_TYPE_DRIVER, 121750, 1400, 1488,
+		   1632, 1864, 0, 1050, 1053, 1057, 1089, 0,
+		   DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_PVSYNC) },
+	/* 1440x900@60Hz */
+	{ DRM_MODE("1440x900", DRM_MODE_TYPE_DRIVER, 106500, 1440, 1520,
+		   1672, 1904, 0, 900, 903, 909, 934, 0,
+		   DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_PVSYNC) },
+	/* 1600x1200@60Hz */
+	{ DRM_MODE("1600x1200", DRM_MODE_TYPE_DRIVER, 162000, 1600, 1664,
+		   1856, 2160, 0, 1200, 1201, 1204, 1250, 0,
+		   DRM_MODE_FLAG_PHSYNC | DRM_MODE_FLAG_PVSYNC) },
+	/* 1680x1050@60Hz */
+	{ DRM_MODE("1680x1050", DRM_MODE_TYPE_DRIVER, 146250, 1680, 1784,
+		   1960, 2240, 0, 1050, 1053, 1059, 1089, 0,
+		   DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_PVSYNC) },
+	/* 1792x1344@60Hz */
+	{ DRM_MODE("1792x1344", DRM_MODE_TYPE_DRIVER, 204750, 1792, 1920,
+		   2120, 2448, 0, 1344, 1345, 1348, 1394, 0,
+		   DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_PVSYNC) },
+	/* 1853x1392@60Hz */
+	{ DRM_MODE("1856x1392", DRM_MODE_TYPE_DRIVER, 218250, 1856, 1952,
+		   2176, 2528, 0, 1392, 1393, 1396, 1439, 0,
+		   DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_PVSYNC) },
+	/* 1920x1200@60Hz */
+	{ DRM_MODE("1920x1200", DRM_MODE_TYPE_DRIVER, 193250, 1920, 2056,
+		   2256, 2592, 0, 1200, 1203, 1209, 1245, 0,
+		   DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_PVSYNC) },
+	/* 1920x1440@60Hz */
+	{ DRM_MODE("1920x1440", DRM_MODE_TYPE_DRIVER, 234000, 1920, 2048,
+		   2256, 2600, 0, 1440, 1441, 1444, 1500, 0,
+		   DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_PVSYNC) },
+	/* 2560x1600@60Hz */
+	{ DRM_MODE("2560x1600", DRM_MODE_TYPE_DRIVER, 348500, 2560, 2752,
+		   3032, 3504, 0, 1600, 1603, 1609, 1658, 0,
+		   DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_PVSYNC) },
+	/* Terminate */
+	{ DRM_MODE("", 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0) },
+};
+
+int vmw_du_connector_fill_modes(struct drm_connector *connector,
+				uint32_t max_width, uint32_t max_height)
+{
+	struct vmw_display_unit *du = vmw_connector_to_du(connector);
+	struct drm_device *dev = connector->dev;
+	struct vmw_private *dev_priv = vmw_priv(dev);
+	struct drm_display_mode *mode = NULL;
+	struct drm_display_mode *bmode;
+        struct drm_display_mode prefmode = { DRM_MODE("preferred",
+		DRM_MODE_TYPE_DRIVER | DRM_MODE_TYPE_PREFERRED,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_PVSYNC)
+	};
+	int i;
+
+	/*
+	 * The mode list only depends on the preferred size and the
+	 * limits, so reuse it if none of those changed since it was built.
+	 * A layout change from the host (hotplug) changes the preferred
+	 * size and thus rebuilds the list; repeated identical layouts don't.
+	 */
+	if (du->modes_valid &&
+	    du->modes_pref_width == du->pref_width &&
+	    du->modes_pref_height == du->pref_height &&
+	    du->modes_max_width == max_width &&
+	    du->modes_max_height == max_height &&
+	    !list_empty(&connector->modes))
+		return 1;
+
+	/* Add preferred mode */
+	{
+		mode = drm_mode_duplicate(dev, &prefmode);
+		if (!mode)
+			return 0;
+		mode->hdisplay = du->pref_width;
+		mode->vdisplay = du->pref_height;
+		mode->vrefresh = drm_mode_vrefresh(mode);
+		if (dev_priv->sou_priv ||
+		    vmw_kms_validate_mode_vram(dev_priv, mode->hdisplay * 2,
+					       mode->vdisplay)) {
+			drm_mode_probed_add(connector, mode);
+
+			if (du->pref_mode) {
+				list_del_init(&du->pref_mode->head);
+				drm_mode_destroy(dev, du->pref_mode);
+			}
+
+			du->pref_mode = mode;
+		}
+	}
+
+	for (i = 0; vmw_kms_connector_builtin[i].type != 0; i++) {
+		bmode = &vmw_kms_connector_builtin[i];
+		if (bmode->hdisplay > max_width ||
+		    bmode->vdisplay > max_height)
+			continue;
+
+		/* Screen objects don't scan out from VRAM. */
+		if (!dev_priv->sou_priv &&
+		    !vmw_kms_validate_mode_vram(dev_priv, bmode->hdisplay * 2,
+						bmode->vdisplay))
+			continue;
+
+		mode = drm_mode_duplicate(dev, bmode);
+		if (!mode)
+			return 0;
+		mode->vrefresh = drm_mode_vrefresh(mode);
+
+		drm_mode_probed_add(connector, mode);
+	}
+
+	drm_mode_connector_list_update(connector);
+
+	du->modes_pref_width = du->pref_width;
+	du->modes_pref_height = du->pref_height;
+	du->modes_max_width = max_width;
+	du->modes_max_height = max_height;
+	du->modes_valid = true;
+
+	return 1;
+}
+
+/**
+ * vmw_cursor_snoop_clip - Clip a DMA copy box to the 64x64 cursor image.
+ *
+ * Returns false if nothing of the box lands in the image. The box itself
+ * is left untouched, since the device still executes the command.
+ */
+static bool vmw_cursor_snoop_clip(const SVGA3dCopyBox *box,
+				  uint32_t *w, uint32_t *h)
+{
+	if (box->z != 0 || box->srcz != 0 || box->d == 0 ||
+	    box->x >= 64 || box->y >= 64)
+		return false;
+
+	*w = min_t(uint32_t, box->w, 64 - box->x);
+	*h = min_t(uint32_t, box->h, 64 - box->y);
+
+	return *w != 0 && *h != 0;
+}
+
+/**
+ * vmw_kms_cursor_snoop - Mirror a guest-to-host DMA into a cursor surface.
+ *
+ * Every copy box of the DMA is clipped to the 64x64 cursor image and the
+ * touched rows are copied from the guest buffer into the snooper image,
+ * honoring arbitrary guest offsets and pitches. Only the pages spanned
+ * by the boxes are mapped. The snooper age is bumped only if the image
+ * content actually changed, so that the cursor is redefined only then.
+ */
 void vmw_kms_cursor_snoop(struct vmw_surface *srf,
 			  struct ttm_object_file *tfile,
 			  struct ttm_buffer_object *bo,
@@ -206,9 +458,15 @@ void vmw_kms_cursor_snoop(struct vmw_surface *srf,
 	struct ttm_bo_kmap_obj map;
 	unsigned long kmap_offset;
 	unsigned long kmap_num;
+	u64 start = ULLONG_MAX;
+	u64 end = 0;
+	u64 bo_size = (u64) bo->num_pages << PAGE_SHIFT;
+	uint32_t pitch, offset, w, h;
 	SVGA3dCopyBox *box;
 	unsigned box_count;
-	void *virtual;
+	unsigned i, row;
+	bool changed = false;
+	u8 *virtual;
 	bool dummy;
 	struct vmw_dma_cmd {
 		SVGA3dCmdHeader header;
@@ -222,35 +480,57 @@ void vmw_kms_cursor_snoop(struct vmw_surface *srf,
 	if (!srf->snooper.image)
 		return;
 
+	if (cmd->dma.transfer != SVGA3D_WRITE_HOST_VRAM)
+		return;
+
 	if (cmd->dma.host.face != 0 || cmd->dma.host.mipmap != 0) {
 		DRM_ERROR("face and mipmap for cursors should never != 0\n");
 		return;
 	}
 
-	if (cmd->header.size < 64) {
-		DRM_ERROR("at least one full copy box must be given\n");
+	if (cmd->header.size < sizeof(cmd->dma) + sizeof(*box)) {
+		DRM_ERROR("at least one copy box must be given\n");
 		return;
 	}
 
 	box = (SVGA3dCopyBox *)&cmd[1];
 	box_count = (cmd->header.size - sizeof(SVGA3dCmdSurfaceDMA)) /
 			sizeof(SVGA3dCopyBox);
+	pitch = cmd->dma.guest.pitch;
+	offset = cmd->dma.guest.ptr.offset;
 
-	if (cmd->dma.guest.pitch != (64 * 4) ||
-	    cmd->dma.guest.ptr.offset % PAGE_SIZE ||
-	    box->x != 0    || box->y != 0    || box->z != 0    ||
-	    box->srcx != 0 || box->srcy != 0 || box->srcz != 0 ||
-	    box->w != 64   || box->h != 64   || box->d != 1    ||
-	    box_count != 1) {
-		/* TODO handle none page aligned offsets */
-		/* TODO handle partial uploads and pitch != 256 */
-		/* TODO handle more then one copy (size != 64) */
-		DRM_ERROR("lazy programer, cant handle wierd stuff\n");
-		return;
+	/*
+	 * Find the range of the guest buffer the clipped boxes read from.
+	 */
+
+	for (i = 0; i < box_count; ++i) {
+		u64 first, last;
+
+		if (!vmw_cursor_snoop_clip(&box[i], &w, &h))
+			continue;
+
+		if (h > 1 && pitch < w * 4) {
+			DRM_ERROR("invalid cursor dma pitch %u\n", pitch);
+			return;
+		}
+
+		first = (u64) offset + (u64) box[i].srcy * pitch +
+			(u64) box[i].srcx * 4;
+		last = first + (u64) (h - 1) * pitch + w * 4;
+		if (last > bo_size) {
+			DRM_ERROR("cursor dma outside of buffer\n");
+			return;
+		}
+
+		start = min_t(u64, start, first);
+		end = max_t(u64, end, last);
 	}
 
-	kmap_offset = cmd->dma.guest.ptr.offset >> PAGE_SHIFT;
-	kmap_num = (64*64*4) >> PAGE_SHIFT;
+	if (start >= end)
+		return;
+
+	kmap_offset = start >> PAGE_SHIFT;
+	kmap_num = ((end - 1) >> PAGE_SHIFT) - kmap_offset + 1;
 
 	ret = ttm_bo_reserve(bo, true, false, false, 0);
 	if (unlikely(ret != 0)) {
@@ -262,10 +542,30 @@ void vmw_kms_cursor_snoop(struct vmw_surface *srf,
 	if (unlikely(ret != 0))
 		goto err_unreserve;
 
-	virtual = ttm_kmap_obj_virtual(&map, &dummy);
+	virtual = (u8 *) ttm_kmap_obj_virtual(&map, &dummy) -
+		(kmap_offset << PAGE_SHIFT);
+
+	for (i = 0; i < box_count; ++i) {
+		if (!vmw_cursor_snoop_clip(&box[i], &w, &h))
+			continue;
+
+		for (row = 0; row < h; ++row) {
+			u32 *dst = srf->snooper.image +
+				(box[i].y + row) * 64 + box[i].x;
+			u8 *src = virtual + offset +
+				(unsigned long) (box[i].srcy + row) * pitch +
+				box[i].srcx * 4;
+
+			if (memcmp(dst, src, w * 4) == 0)
+				continue;
 
-	memcpy(srf->snooper.image, virtual, 64*64*4);
-	srf->snooper.age++;
+			memcpy(dst, src, w * 4);
+			changed = true;
+		}
+	}
+
+	if (changed)
+		srf->snooper.age++;
 
 	/* we can't call this function from this function since execbuf has
 	 * reserved fifo space.
@@ -318,6 +618,101 @@ int vmw_framebuffer_create_handle(struct drm_framebuffer *fb,
 	return 0;
 }
 
+/*
+ * Damage accumulation
+ */
+
+static inline int64_t vmw_rect_area(const struct drm_clip_rect *r)
+{
+	return (int64_t) (r->x2 - r->x1) * (int64_t) (r->y2 - r->y1);
+}
+
+static inline void vmw_rect_union(struct drm_clip_rect *dst,
+				  const struct drm_clip_rect *src)
+{
+	dst->x1 = min(dst->x1, src->x1);
+	dst->y1 = min(dst->y1, src->y1);
+	dst->x2 = max(dst->x2, src->x2);
+	dst->y2 = max(dst->y2, src->y2);
+}
+
+/**
+ * vmw_damage_merge_cost - Number of pixels the host would transfer in
+ * excess if @a and @b were replaced by their bounding rectangle.
+ *
+ * Overlapping rectangles yield a negative cost, since their common area
+ * would otherwise be transferred twice.
+ */
+static int64_t vmw_damage_merge_cost(const struct drm_clip_rect *a,
+				     const struct drm_clip_rect *b)
+{
+	struct drm_clip_rect u = *a;
+
+	vmw_rect_union(&u, b);
+	return vmw_rect_area(&u) - vmw_rect_area(a) - vmw_rect_area(b);
+}
+
+static void vmw_damage_init(struct vmw_damage *damage)
+{
+	damage->num_rects = 0;
+}
+
+/**
+ * vmw_damage_add - Add a rectangle to a damage accumulator.
+ *
+ * @damage: The accumulator.
+ * @clip: The damaged rectangle.
+ *
+ * The rectangle is merged with any accumulated rectangle for which that
+ * is cheaper than sending both, and the merged result is retried against
+ * the remaining ones. If the accumulator is full, the rectangle is merged
+ * with the partner that wastes the least area.
+ */
+static void vmw_damage_add(struct vmw_damage *damage,
+			   const struct drm_clip_rect *clip)
+{
+	struct drm_clip_rect rect = *clip;
+	int64_t cost, best_cost;
+	unsigned i, best;
+
+	if (rect.x1 >= rect.x2 || rect.y1 >= rect.y2)
+		return;
+
+restart:
+	best = 0;
+	best_cost = LLONG_MAX;
+	for (i = 0; i < damage->num_rects; ++i) {
+		cost = vmw_damage_merge_cost(&rect, &damage->rects[i]);
+		if (cost <= VMW_DAMAGE_RECT_COST) {
+			vmw_rect_union(&rect, &damage->rects[i]);
+			damage->rects[i] = damage->rects[--damage->num_rects];
+			goto restart;
+		}
+		if (cost < best_cost) {
+			best_cost = cost;
+			best = i;
+		}
+	}
+
+	if (damage->num_rects == VMW_DAMAGE_MAX_RECTS) {
+		vmw_rect_union(&rect, &damage->rects[best]);
+		damage->rects[best] = damage->rects[--damage->num_rects];
+		goto restart;
+	}
+
+	damage->rects[damage->num_rects++] = rect;
+}
+
+static void vmw_damage_add_clips(struct vmw_damage *damage,
+				 struct drm_clip_rect *clips,
+				 unsigned num_clips, int increment)
+{
+	unsigned i;
+
+	for (i = 0; i < num_clips; ++i, clips += increment)
+		vmw_damage_add(damage, clips);
+}
+
 /*
  * Surface framebuffer code
  */
@@ -332,6 +727,7 @@ struct vmw_framebuffer_surface {
 	struct delayed_work d_work;
 	struct mutex work_lock;
 	bool present_fs;
+	struct vmw_damage damage;
 	struct list_head head;
 	struct drm_master *master;
 };
@@ -383,15 +779,162 @@ void vmw_framebuffer_surface_destroy(struct drm_framebuffer *framebuffer)
 	kfree(vfbs);
 }
 
-static void vmw_framebuffer_present_fs_callback(struct work_struct *work)
+static int do_surface_dirty_present(struct vmw_private *dev_priv,
+				    struct vmw_framebuffer_surface *vfbs,
+				    struct drm_clip_rect *clips,
+				    unsigned num_clips, int increment)
+{
+	struct vmw_surface *surf = vfbs->surface;
+	SVGA3dCopyRect *cr;
+	int i;
+
+	struct {
+		SVGA3dCmdHeader header;
+		SVGA3dCmdPresent body;
+		SVGA3dCopyRect cr;
+	} *cmd;
+
+	cmd = vmw_fifo_reserve(dev_priv, sizeof(*cmd) + (num_clips - 1) * sizeof(cmd->cr));
+	if (unlikely(cmd == NULL)) {
+		DRM_ERROR("Fifo reserve failed.\n");
+		return -ENOMEM;
+	}
+
+	memset(cmd, 0, sizeof(*cmd));
+
+	cmd->header.id = cpu_to_le32(SVGA_3D_CMD_PRESENT);
+	cmd->header.size = cpu_to_le32(sizeof(cmd->body) + num_clips * sizeof(cmd->cr));
+	cmd->body.sid = cpu_to_le32(surf->res.id);
+
+	for (i = 0, cr = &cmd->cr; i < num_clips; i++, cr++, clips += increment) {
+		cr->x = cpu_to_le16(clips->x1);
+		cr->y = cpu_to_le16(clips->y1);
+		cr->srcx = cr->x;
+		cr->srcy = cr->y;
+		cr->w = cpu_to_le16(clips->x2 - clips->x1);
+		cr->h = cpu_to_le16(clips->y2 - clips->y1);
+	}
+
+	vmw_fifo_commit(dev_priv, sizeof(*cmd) + (num_clips - 1) * sizeof(cmd->cr));
+
+	return 0;
+}
+
+/**
+ * do_surface_dirty_sou - Blit dirty regions of a surface framebuffer
+ * to the screen objects scanning it out.
+ *
+ * One SVGA_3D_CMD_BLIT_SURFACE_TO_SCREEN is emitted per screen showing
+ * the framebuffer, with the screen's viewport as source rect and the
+ * clip rects, made relative to the screen, as its clipping region.
+ * Must be called with the mode_config mutex held.
+ */
+static int do_surface_dirty_sou(struct vmw_private *dev_priv,
+				struct vmw_framebuffer_surface *vfbs,
+				struct drm_clip_rect *clips,
+				unsigned num_clips, int increment)
+{
+	struct drm_framebuffer *framebuffer = &vfbs->base.base;
+	struct drm_device *dev = dev_priv->dev;
+	struct drm_clip_rect *clip;
+	struct drm_crtc *crtc;
+	SVGASignedRect *rect;
+	unsigned num_units = 0;
+	size_t fifo_size;
+	size_t used = 0;
+	uint8_t *fifo;
+	int i;
+
+	struct {
+		SVGA3dCmdHeader header;
+		SVGA3dCmdBlitSurfaceToScreen body;
+	} *blit;
+
+	list_for_each_entry(crtc, &dev->mode_config.crtc_list, head) {
+		if (crtc->fb == framebuffer)
+			num_units++;
+	}
+
+	if (num_units == 0)
+		return 0;
+
+	fifo_size = num_units * (sizeof(*blit) + num_clips * sizeof(*rect));
+	fifo = vmw_fifo_reserve(dev_priv, fifo_size);
+	if (unlikely(fifo == NULL)) {
+		DRM_ERROR("Fifo reserve failed.\n");
+		return -ENOMEM;
+	}
+
+	list_for_each_entry(crtc, &dev->mode_config.crtc_list, head) {
+		int x1 = crtc->x;
+		int y1 = crtc->y;
+		int x2 = crtc->x + crtc->mode.hdisplay;
+		int y2 = crtc->y + crtc->mode.vdisplay;
+		unsigned num_rects = 0;
+
+		if (crtc->fb != framebuffer)
+			continue;
+
+		blit = (void *) (fifo + used);
+		rect = (SVGASignedRect *) &blit[1];
+		for (i = 0, clip = clips; i < num_clips;
+		     i++, clip += increment) {
+			int left = max_t(int, clip->x1, x1);
+			int top = max_t(int, clip->y1, y1);
+			int right = min_t(int, clip->x2, x2);
+			int bottom = min_t(int, clip->y2, y2);
+
+			if (left >= right || top >= bottom)
+				continue;
+
+			rect->left = left - x1;
+			rect->top = top - y1;
+			rect->right = right - x1;
+			rect->bottom = bottom - y1;
+			rect++;
+			num_rects++;
+		}
+
+		if (num_rects == 0)
+			continue;
+
+		memset(blit, 0, sizeof(*blit));
+		blit->header.id = cpu_to_le32(SVGA_3D_CMD_BLIT_SURFACE_TO_SCREEN);
+		blit->header.size = cpu_to_le32(sizeof(blit->body) +
+						num_rects * sizeof(*rect));
+		blit->body.srcImage.sid = cpu_to_le32(vfbs->surface->res.id);
+		blit->body.srcRect.left = x1;
+		blit->body.srcRect.top = y1;
+		blit->body.srcRect.right = x2;
+		blit->body.srcRect.bottom = y2;
+		blit->body.destScreenId = vmw_crtc_to_du(crtc)->unit;
+		blit->body.destRect.left = 0;
+		blit->body.destRect.top = 0;
+		blit->body.destRect.right = x2 - x1;
+		blit->body.destRect.bottom = y2 - y1;
+		used += sizeof(*blit) + num_rects * sizeof(*rect);
+	}
+
+	vmw_fifo_commit(dev_priv, used);
+
+	return 0;
+}
+
+/**
+ * vmw_framebuffer_present - Flush accumulated damage.
+ *
+ * Presents either the full framebuffer or the accumulated damage
+ * rectangles, and then re-arms the present work so that further damage
+ * arriving within the present period is batched into the next flush.
+ * With screen objects, the damage is blitted to each screen showing the
+ * framebuffer, so the mode_config mutex must be held.
+ */
+static void vmw_framebuffer_present(struct vmw_framebuffer_surface *vfbs)
 {
-	struct delayed_work *d_work =
-		container_of(work, struct delayed_work, work);
-	struct vmw_framebuffer_surface *vfbs =
-		container_of(d_work, struct vmw_framebuffer_surface, d_work);
 	struct vmw_surface *surf = vfbs->surface;
 	struct drm_framebuffer *framebuffer = &vfbs->base.base;
 	struct vmw_private *dev_priv = vmw_priv(framebuffer->dev);
+	struct drm_clip_rect full;
 
 	struct {
 		SVGA3dCmdHeader header;
@@ -407,8 +950,39 @@ static void vmw_framebuffer_present_fs_callback(struct work_struct *work)
 	 */
 
 	mutex_lock(&vfbs->work_lock);
-	if (!vfbs->present_fs)
-		goto out_unlock;
+	if (dev_priv->sou_priv) {
+		int ret;
+
+		if (vfbs->present_fs) {
+			full.x1 = full.y1 = 0;
+			full.x2 = framebuffer->width;
+			full.y2 = framebuffer->height;
+			ret = do_surface_dirty_sou(dev_priv, vfbs, &full, 1, 1);
+		} else if (vfbs->damage.num_rects == 0) {
+			goto out_unlock;
+		} else {
+			ret = do_surface_dirty_sou(dev_priv, vfbs,
+						   vfbs->damage.rects,
+						   vfbs->damage.num_rects, 1);
+		}
+
+		if (ret == 0) {
+			vfbs->present_fs = false;
+			vmw_damage_init(&vfbs->damage);
+		}
+		goto out_resched;
+	}
+
+	if (!vfbs->present_fs) {
+		if (vfbs->damage.num_rects == 0)
+			goto out_unlock;
+
+		if (do_surface_dirty_present(dev_priv, vfbs,
+					     vfbs->damage.rects,
+					     vfbs->damage.num_rects, 1) == 0)
+			vmw_damage_init(&vfbs->damage);
+		goto out_resched;
+	}
 
 	cmd = vmw_fifo_reserve(dev_priv, sizeof(*cmd));
 	if (unlikely(cmd == NULL))
@@ -424,6 +998,7 @@ static void vmw_framebuffer_present_fs_callback(struct work_struct *work)
 	cmd->cr.w = cpu_to_le32(framebuffer->width);
 	cmd->cr.h = cpu_to_le32(framebuffer->height);
 	vfbs->present_fs = false;
+	vmw_damage_init(&vfbs->damage);
 	vmw_fifo_commit(dev_priv, sizeof(*cmd));
 out_resched:
 	/**
@@ -434,6 +1009,32 @@ out_unlock:
 	mutex_unlock(&vfbs->work_lock);
 }
 
+/**
+ * vmw_framebuffer_present_callback - Present work function.
+ *
+ * Framebuffer destruction cancels this work with the mode_config mutex
+ * held, so the mutex is only tried here, and the present is retried a
+ * period later if it is contended.
+ */
+static void vmw_framebuffer_present_callback(struct work_struct *work)
+{
+	struct delayed_work *d_work =
+		container_of(work, struct delayed_work, work);
+	struct vmw_framebuffer_surface *vfbs =
+		container_of(d_work, struct vmw_framebuffer_surface, d_work);
+	struct drm_device *dev = vfbs->base.base.dev;
+	bool sou = (vmw_priv(dev)->sou_priv != NULL);
+
+	if (sou && !mutex_trylock(&dev->mode_config.mutex)) {
+		schedule_delayed_work(&vfbs->d_work, VMWGFX_PRESENT_RATE);
+		return;
+	}
+
+	vmw_framebuffer_present(vfbs);
+
+	if (sou)
+		mutex_unlock(&dev->mode_config.mutex);
+}
 
 int vmw_framebuffer_surface_dirty(struct drm_framebuffer *framebuffer,
 				  struct drm_file *file_priv,
@@ -445,18 +1046,9 @@ int vmw_framebuffer_surface_dirty(struct drm_framebuffer *framebuffer,
 	struct vmw_master *vmaster = vmw_master(file_priv->master);
 	struct vmw_framebuffer_surface *vfbs =
 		vmw_framebuffer_to_vfbs(framebuffer);
-	struct vmw_surface *surf = vfbs->surface;
-	struct drm_clip_rect norect;
-	SVGA3dCopyRect *cr;
-	int i, inc = 1;
+	int inc = 1;
 	int ret;
 
-	struct {
-		SVGA3dCmdHeader header;
-		SVGA3dCmdPresent body;
-		SVGA3dCopyRect cr;
-	} *cmd;
-
 	if (unlikely(vfbs->master != file_priv->master))
 		return -EINVAL;
 
@@ -464,60 +1056,34 @@ int vmw_framebuffer_surface_dirty(struct drm_framebuffer *framebuffer,
 	if (unlikely(ret != 0))
 		return ret;
 
-	if (!num_clips ||
-	    !(dev_priv->fifo.capabilities &
-	      SVGA_FIFO_CAP_SCREEN_OBJECT)) {
-		int ret;
-
-		mutex_lock(&vfbs->work_lock);
-		vfbs->present_fs = true;
-		ret = schedule_delayed_work(&vfbs->d_work, VMWGFX_PRESENT_RATE);
-		mutex_unlock(&vfbs->work_lock);
-		if (ret) {
-			/**
-			 * No work pending, Force immediate present.
-			 */
-			vmw_framebuffer_present_fs_callback(&vfbs->d_work.work);
-		}
-		ttm_read_unlock(&vmaster->lock);
-		return 0;
-	}
-
-	if (!num_clips) {
-		num_clips = 1;
-		clips = &norect;
-		norect.x1 = norect.y1 = 0;
-		norect.x2 = framebuffer->width;
-		norect.y2 = framebuffer->height;
-	} else if (flags & DRM_MODE_FB_DIRTY_ANNOTATE_COPY) {
+	if (flags & DRM_MODE_FB_DIRTY_ANNOTATE_COPY) {
 		num_clips /= 2;
 		inc = 2; /* skip source rects */
 	}
 
-	cmd = vmw_fifo_reserve(dev_priv, sizeof(*cmd) + (num_clips - 1) * sizeof(cmd->cr));
-	if (unlikely(cmd == NULL)) {
-		DRM_ERROR("Fifo reserve failed.\n");
-		ttm_read_unlock(&vmaster->lock);
-		return -ENOMEM;
-	}
-
-	memset(cmd, 0, sizeof(*cmd));
-
-	cmd->header.id = cpu_to_le32(SVGA_3D_CMD_PRESENT);
-	cmd->header.size = cpu_to_le32(sizeof(cmd->body) + num_clips * sizeof(cmd->cr));
-	cmd->body.sid = cpu_to_le32(surf->res.id);
+	/**
+	 * Damage is accumulated and flushed by the delayed work at most
+	 * VMWGFX_PRESENT_RATE apart. Without screen objects, partial presents
+	 * aren't reliable, so fall back to presenting the full framebuffer.
+	 */
 
-	for (i = 0, cr = &cmd->cr; i < num_clips; i++, cr++, clips += inc) {
-		cr->x = cpu_to_le16(clips->x1);
-		cr->y = cpu_to_le16(clips->y1);
-		cr->srcx = cr->x;
-		cr->srcy = cr->y;
-		cr->w = cpu_to_le16(clips->x2 - clips->x1);
-		cr->h = cpu_to_le16(clips->y2 - clips->y1);
+	mutex_lock(&vfbs->work_lock);
+	if (!num_clips ||
+	    !(dev_priv->fifo.capabilities &
+	      SVGA_FIFO_CAP_SCREEN_OBJECT))
+		vfbs->present_fs = true;
+	else
+		vmw_damage_add_clips(&vfbs->damage, clips, num_clips, inc);
+	ret = schedule_delayed_work(&vfbs->d_work, VMWGFX_PRESENT_RATE);
+	mutex_unlock(&vfbs->work_lock);
+	if (ret) {
+		/**
+		 * No work pending, Force immediate present.
+		 */
+		vmw_framebuffer_present(vfbs);
 	}
-
-	vmw_fifo_commit(dev_priv, sizeof(*cmd) + (num_clips - 1) * sizeof(cmd->cr));
 	ttm_read_unlock(&vmaster->lock);
+
 	return 0;
 }
 
@@ -602,14 +1168,17 @@ static int vmw_kms_new_framebuffer_surface(struct vmw_private *dev_priv,
 	vfbs->base.base.depth = mode_cmd->depth;
 	vfbs->base.base.width = mode_cmd->width;
 	vfbs->base.base.height = mode_cmd->height;
-	vfbs->base.pin = &vmw_surface_dmabuf_pin;
-	vfbs->base.unpin = &vmw_surface_dmabuf_unpin;
+	if (!dev_priv->sou_priv) {
+		vfbs->base.pin = &vmw_surface_dmabuf_pin;
+		vfbs->base.unpin = &vmw_surface_dmabuf_unpin;
+	}
 	vfbs->surface = surface;
 	vfbs->master = drm_master_get(file_priv->master);
 	mutex_init(&vfbs->work_lock);
+	vmw_damage_init(&vfbs->damage);
 
 	mutex_lock(&vmaster->fb_surf_mutex);
-	INIT_DELAYED_WORK(&vfbs->d_work, &vmw_framebuffer_present_fs_callback);
+	INIT_DELAYED_WORK(&vfbs->d_work, &vmw_framebuffer_present_callback);
 	list_add_tail(&vfbs->head, &vmaster->fb_surf);
 	mutex_unlock(&vmaster->fb_surf_mutex);
 
@@ -648,6 +1217,178 @@ void vmw_framebuffer_dmabuf_destroy(struct drm_framebuffer *framebuffer)
 	kfree(vfbd);
 }
 
+static int do_dmabuf_dirty_ldu(struct vmw_private *dev_priv,
+			       struct drm_clip_rect *clips,
+			       unsigned num_clips, int increment)
+{
+	struct {
+		uint32_t header;
+		SVGAFifoCmdUpdate body;
+	} *cmd;
+	int i;
+
+	cmd = vmw_fifo_reserve(dev_priv, sizeof(*cmd) * num_clips);
+	if (unlikely(cmd == NULL)) {
+		DRM_ERROR("Fifo reserve failed.\n");
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < num_clips; i++, clips += increment) {
+		cmd[i].header = cpu_to_le32(SVGA_CMD_UPDATE);
+		cmd[i].body.x = cpu_to_le32(clips->x1);
+		cmd[i].body.y = cpu_to_le32(clips->y1);
+		cmd[i].body.width = cpu_to_le32(clips->x2 - clips->x1);
+		cmd[i].body.height = cpu_to_le32(clips->y2 - clips->y1);
+	}
+
+	vmw_fifo_commit(dev_priv, sizeof(*cmd) * num_clips);
+
+	return 0;
+}
+
+/**
+ * do_dmabuf_dirty_sou - Blit dirty regions of a dmabuf framebuffer
+ * to the screen objects scanning it out.
+ *
+ * The buffer is validated into VRAM or a GMR, the GMRFB is pointed at it
+ * and every clip rect is blitted to each screen whose viewport it
+ * intersects. The buffer is then fenced so that it can't move until the
+ * device is done reading from it. If @out_fence is non-NULL, a reference
+ * to that fence is returned in it. Must be called with the
+ * mode_config mutex held.
+ */
+static int do_dmabuf_dirty_sou(struct vmw_private *dev_priv,
+			       struct vmw_framebuffer_dmabuf *vfbd,
+			       struct drm_clip_rect *clips,
+			       unsigned num_clips, int increment,
+			       struct vmw_fence_obj **out_fence)
+{
+	struct drm_framebuffer *framebuffer = &vfbd->base.base;
+	struct drm_device *dev = dev_priv->dev;
+	struct ttm_buffer_object *bo = &vfbd->buffer->base;
+	struct ttm_validate_buffer val_buf;
+	struct vmw_fence_obj *fence = NULL;
+	struct drm_clip_rect *clip;
+	struct list_head validate_list;
+	struct drm_crtc *crtc;
+	unsigned num_units = 0;
+	unsigned num_blits = 0;
+	size_t fifo_size;
+	int i, ret;
+
+	struct {
+		uint32_t header;
+		SVGAFifoCmdDefineGMRFB body;
+	} *gmrfb_cmd;
+	struct {
+		uint32_t header;
+		SVGAFifoCmdBlitGMRFBToScreen body;
+	} *blits;
+
+	list_for_each_entry(crtc, &dev->mode_config.crtc_list, head) {
+		if (crtc->fb == framebuffer)
+			num_units++;
+	}
+
+	if (out_fence)
+		*out_fence = NULL;
+
+	if (num_units == 0)
+		return 0;
+
+	INIT_LIST_HEAD(&validate_list);
+	memset(&val_buf, 0, sizeof(val_buf));
+	val_buf.bo = ttm_bo_reference(bo);
+	val_buf.new_sync_obj_arg = (void *) DRM_VMW_FENCE_FLAG_EXEC;
+	list_add_tail(&val_buf.head, &validate_list);
+
+	ret = ttm_eu_reserve_buffers(&validate_list);
+	if (unlikely(ret != 0))
+		goto out_unref;
+
+	ret = ttm_bo_validate(bo, &vmw_vram_gmr_placement, true, false, false);
+	if (unlikely(ret != 0))
+		goto out_backoff;
+
+	fifo_size = sizeof(*gmrfb_cmd) +
+		sizeof(*blits) * num_units * num_clips;
+	gmrfb_cmd = vmw_fifo_reserve(dev_priv, fifo_size);
+	if (unlikely(gmrfb_cmd == NULL)) {
+		DRM_ERROR("Fifo reserve failed.\n");
+		ret = -ENOMEM;
+		goto out_backoff;
+	}
+
+	memset(gmrfb_cmd, 0, sizeof(*gmrfb_cmd));
+	gmrfb_cmd->header = SVGA_CMD_DEFINE_GMRFB;
+	if (bo->mem.mem_type == TTM_PL_VRAM) {
+		gmrfb_cmd->body.ptr.gmrId = SVGA_GMR_FRAMEBUFFER;
+		gmrfb_cmd->body.ptr.offset = bo->offset;
+	} else {
+		gmrfb_cmd->body.ptr.gmrId = bo->mem.start;
+		gmrfb_cmd->body.ptr.offset = 0;
+	}
+	gmrfb_cmd->body.bytesPerLine = framebuffer->pitch;
+	gmrfb_cmd->body.format.bitsPerPixel = framebuffer->bits_per_pixel;
+	/* The device has no notion of alpha for GMRFB blits. */
+	gmrfb_cmd->body.format.colorDepth =
+		(framebuffer->depth == 32) ? 24 : framebuffer->depth;
+
+	blits = (void *) &gmrfb_cmd[1];
+	list_for_each_entry(crtc, &dev->mode_config.crtc_list, head) {
+		int x1 = crtc->x;
+		int y1 = crtc->y;
+		int x2 = crtc->x + crtc->mode.hdisplay;
+		int y2 = crtc->y + crtc->mode.vdisplay;
+
+		if (crtc->fb != framebuffer)
+			continue;
+
+		for (i = 0, clip = clips; i < num_clips;
+		     i++, clip += increment) {
+			int left = max_t(int, clip->x1, x1);
+			int top = max_t(int, clip->y1, y1);
+			int right = min_t(int, clip->x2, x2);
+			int bottom = min_t(int, clip->y2, y2);
+
+			if (left >= right || top >= bottom)
+				continue;
+
+			blits->header = SVGA_CMD_BLIT_GMRFB_TO_SCREEN;
+			blits->body.srcOrigin.x = left;
+			blits->body.srcOrigin.y = top;
+			blits->body.destRect.left = left - x1;
+			blits->body.destRect.top = top - y1;
+			blits->body.destRect.right = right - x1;
+			blits->body.destRect.bottom = bottom - y1;
+			blits->body.destScreenId = vmw_crtc_to_du(crtc)->unit;
+			blits++;
+			num_blits++;
+		}
+	}
+
+	vmw_fifo_commit(dev_priv, sizeof(*gmrfb_cmd) +
+			sizeof(*blits) * num_blits);
+
+	(void) vmw_execbuf_fence_commands(NULL, dev_priv, &fence, NULL);
+	ttm_eu_fence_buffer_objects(&validate_list, (void *) fence);
+	if (out_fence)
+		*out_fence = fence;
+	else if (likely(fence != NULL))
+		vmw_fence_obj_unreference(&fence);
+
+	ttm_bo_unref(&val_buf.bo);
+
+	return 0;
+
+out_backoff:
+	ttm_eu_backoff_reservation(&validate_list);
+out_unref:
+	ttm_bo_unref(&val_buf.bo);
+
+	return ret;
+}
+
 int vmw_framebuffer_dmabuf_dirty(struct drm_framebuffer *framebuffer,
 				 struct drm_file *file_priv,
 				 unsigned flags, unsigned color,
@@ -656,13 +1397,11 @@ int vmw_framebuffer_dmabuf_dirty(struct drm_framebuffer *framebuffer,
 {
 	struct vmw_private *dev_priv = vmw_priv(framebuffer->dev);
 	struct vmw_master *vmaster = vmw_master(file_priv->master);
+	struct vmw_framebuffer_dmabuf *vfbd =
+		vmw_framebuffer_to_vfbd(framebuffer);
 	struct drm_clip_rect norect;
-	int ret;
-	struct {
-		uint32_t header;
-		SVGAFifoCmdUpdate body;
-	} *cmd;
-	int i, increment = 1;
+	struct vmw_damage damage;
+	int ret, increment = 1;
 
 	ret = ttm_read_lock(&vmaster->lock, true);
 	if (unlikely(ret != 0))
@@ -679,25 +1418,28 @@ int vmw_framebuffer_dmabuf_dirty(struct drm_framebuffer *framebuffer,
 		increment = 2;
 	}
 
-	cmd = vmw_fifo_reserve(dev_priv, sizeof(*cmd) * num_clips);
-	if (unlikely(cmd == NULL)) {
-		DRM_ERROR("Fifo reserve failed.\n");
-		ttm_read_unlock(&vmaster->lock);
-		return -ENOMEM;
-	}
+	/**
+	 * Coalesce the clip list before emitting, so that clients sending
+	 * lots of tiny rects don't generate one host update per rect.
+	 */
 
-	for (i = 0; i < num_clips; i++, clips += increment) {
-		cmd[i].header = cpu_to_le32(SVGA_CMD_UPDATE);
-		cmd[i].body.x = cpu_to_le32(clips->x1);
-		cmd[i].body.y = cpu_to_le32(clips->y1);
-		cmd[i].body.width = cpu_to_le32(clips->x2 - clips->x1);
-		cmd[i].body.height = cpu_to_le32(clips->y2 - clips->y1);
-	}
+	vmw_damage_init(&damage);
+	vmw_damage_add_clips(&damage, clips, num_clips, increment);
+	if (damage.num_rects == 0)
+		goto out_unlock;
+
+	if (dev_priv->sou_priv)
+		ret = do_dmabuf_dirty_sou(dev_priv, vfbd, damage.rects,
+					  damage.num_rects, 1, NULL);
+	else
+		ret = do_dmabuf_dirty_ldu(dev_priv, damage.rects,
+					  damage.num_rects, 1);
+
+out_unlock:
 
-	vmw_fifo_commit(dev_priv, sizeof(*cmd) * num_clips);
 	ttm_read_unlock(&vmaster->lock);
 
-	return 0;
+	return ret;
 }
 
 static struct drm_framebuffer_funcs vmw_framebuffer_dmabuf_funcs = {
@@ -818,8 +1560,11 @@ static int vmw_kms_new_framebuffer_dmabuf(struct vmw_private *dev_priv,
 	vfbd->base.base.depth = mode_cmd->depth;
 	vfbd->base.base.width = mode_cmd->width;
 	vfbd->base.base.height = mode_cmd->height;
-	vfbd->base.pin = vmw_framebuffer_dmabuf_pin;
-	vfbd->base.unpin = vmw_framebuffer_dmabuf_unpin;
+	if (!dev_priv->sou_priv) {
+		vfbd->base.pin = vmw_framebuffer_dmabuf_pin;
+		vfbd->base.unpin = vmw_framebuffer_dmabuf_unpin;
+	}
+	vfbd->base.dmabuf = true;
 	vfbd->buffer = dmabuf;
 	*out = &vfbd->base;
 
@@ -833,6 +1578,44 @@ out_err1:
 	return ret;
 }
 
+/**
+ * vmw_kms_sou_update_fb - Push framebuffer contents to screen objects
+ *
+ * @dev_priv: Pointer to device private struct.
+ * @vfb: The framebuffer to read from.
+ * @clips: Regions to update, in framebuffer coordinates.
+ * @num_clips: Number of regions in @clips.
+ * @out_fence: If non-NULL, returns a referenced fence signaling when the
+ * device is done with the update. May return NULL if fencing failed, in
+ * which case the fifo has been synced.
+ *
+ * Used by the screen object display unit to fill a screen with the
+ * contents of the framebuffer it was just bound to. Must be called with
+ * the mode_config mutex held.
+ */
+int vmw_kms_sou_update_fb(struct vmw_private *dev_priv,
+			  struct vmw_framebuffer *vfb,
+			  struct drm_clip_rect *clips,
+			  unsigned num_clips,
+			  struct vmw_fence_obj **out_fence)
+{
+	int ret;
+
+	if (vfb->dmabuf)
+		return do_dmabuf_dirty_sou(dev_priv,
+					   vmw_framebuffer_to_vfbd(&vfb->base),
+					   clips, num_clips, 1, out_fence);
+
+	ret = do_surface_dirty_sou(dev_priv,
+				   vmw_framebuffer_to_vfbs(&vfb->base),
+				   clips, num_clips, 1);
+	if (ret == 0 && out_fence)
+		(void) vmw_execbuf_fence_commands(NULL, dev_priv,
+						  out_fence, NULL);
+
+	return ret;
+}
+
 /*
  * Generic Kernel modesetting functions
  */
@@ -850,21 +1633,17 @@ static struct drm_framebuffer *vmw_kms_fb_create(struct drm_device *dev,
 	int ret;
 
 	/**
-	 * This code should be conditioned on Screen Objects not being used.
-	 * If screen objects are used, we can allocate a GMR to hold the
-	 * requested framebuffer.
+	 * Screen objects blit from a GMR, so the framebuffer doesn't
+	 * need to fit in VRAM.
 	 */
 
 	required_size = mode_cmd->pitch * mode_cmd->height;
-	if (unlikely(required_size > (u64) dev_priv->vram_size)) {
+	if (unlikely(!dev_priv->sou_priv &&
+		     required_size > (u64) dev_priv->vram_size)) {
 		DRM_ERROR("VRAM size is too small for requested mode.\n");
 		return NULL;
 	}
 
-	/**
-	 * End conditioned code.
-	 */
-
 	ret = vmw_user_surface_lookup_handle(dev_priv, tfile,
 					     mode_cmd->handle, &surface);
 	if (ret)
@@ -932,7 +1711,9 @@ int vmw_kms_init(struct vmw_private *dev_priv)
 	dev->mode_config.max_width = 8192;
 	dev->mode_config.max_height = 8192;
 
-	ret = vmw_kms_init_legacy_display_system(dev_priv);
+	ret = vmw_kms_init_screen_object_display(dev_priv);
+	if (ret) /* Fallback */
+		(void)vmw_kms_init_legacy_display_system(dev_priv);
 
 	return 0;
 }
@@ -945,7 +1726,10 @@ int vmw_kms_close(struct vmw_private *dev_priv)
 	 * drm_encoder_cleanup which takes the lock we deadlock.
 	 */
 	drm_mode_config_cleanup(dev_priv->dev);
-	vmw_kms_close_legacy_display_system(dev_priv);
+	if (dev_priv->sou_priv)
+		vmw_kms_close_screen_object_display(dev_priv);
+	else
+		vmw_kms_close_legacy_display_system(dev_priv);
 	return 0;
 }
 
@@ -1065,6 +1849,7 @@ int vmw_kms_restore_vga(struct vmw_private *vmw_priv)
 	struct vmw_vga_topology_state *save;
 	uint32_t i;
 
+	vmw_priv->topology_valid = false;
 	vmw_write(vmw_priv, SVGA_REG_WIDTH, vmw_priv->vga_width);
 	vmw_write(vmw_priv, SVGA_REG_HEIGHT, vmw_priv->vga_height);
 	vmw_write(vmw_priv, SVGA_REG_BITS_PER_PIXEL, vmw_priv->vga_bpp);
@@ -1099,7 +1884,235 @@ bool vmw_kms_validate_mode_vram(struct vmw_private *dev_priv,
 	return ((u64) pitch * (u64) height) < (u64) dev_priv->vram_size;
 }
 
+/*
+ * Synthetic vblank source.
+ *
+ * The device has no vblank interrupt, so each display unit runs an
+ * hrtimer at the refresh rate of its current mode while someone holds
+ * a vblank reference. The counter itself is derived from the time
+ * elapsed since the last mode change, so it keeps advancing while the
+ * timer is off and drm can account for the frames it didn't see.
+ */
+
+#define VMW_VBLANK_DEFAULT_HZ 60
+
+static struct vmw_display_unit *vmw_du_from_index(struct drm_device *dev,
+						  int index)
+{
+	struct drm_crtc *crtc;
+
+	list_for_each_entry(crtc, &dev->mode_config.crtc_list, head) {
+		if (vmw_crtc_to_du(crtc)->unit == index)
+			return vmw_crtc_to_du(crtc);
+	}
+
+	return NULL;
+}
+
+/**
+ * vmw_du_vblank_count_locked - Compute the synthetic vblank counter.
+ *
+ * @du: The display unit.
+ * @now: Current time.
+ *
+ * Must be called with @du->vblank_lock held.
+ */
+static u32 vmw_du_vblank_count_locked(struct vmw_display_unit *du,
+				      ktime_t now)
+{
+	s64 elapsed;
+
+	if (du->vblank_period_ns == 0)
+		return du->vblank_base;
+
+	elapsed = ktime_to_ns(ktime_sub(now, du->vblank_epoch));
+	if (elapsed < 0)
+		elapsed = 0;
+
+	return du->vblank_base +
+		(u32) div64_u64((u64) elapsed, du->vblank_period_ns);
+}
+
+/**
+ * vmw_du_vblank_arm_locked - Arm the timer at the next frame boundary.
+ *
+ * @du: The display unit.
+ * @now: Current time.
+ *
+ * Must be called with @du->vblank_lock held and a non-zero period.
+ */
+static void vmw_du_vblank_arm_locked(struct vmw_display_unit *du,
+				     ktime_t now)
+{
+	u32 frames = vmw_du_vblank_count_locked(du, now) - du->vblank_base;
+	ktime_t next = ktime_add_ns(du->vblank_epoch,
+				    ((u64) frames + 1) * du->vblank_period_ns);
+
+	hrtimer_set_expires(&du->vblank_timer, next);
+}
+
+static enum hrtimer_restart vmw_du_vblank_fn(struct hrtimer *timer)
+{
+	struct vmw_display_unit *du =
+		container_of(timer, struct vmw_display_unit, vblank_timer);
+	enum hrtimer_restart ret = HRTIMER_RESTART;
+	unsigned long irq_flags;
+
+	drm_handle_vblank(du->crtc.dev, du->unit);
+
+	spin_lock_irqsave(&du->vblank_lock, irq_flags);
+	if (du->vblank_enabled && du->vblank_period_ns != 0) {
+		vmw_du_vblank_arm_locked(du, ktime_get());
+	} else {
+		du->vblank_running = false;
+		ret = HRTIMER_NORESTART;
+	}
+	spin_unlock_irqrestore(&du->vblank_lock, irq_flags);
+
+	return ret;
+}
+
+/**
+ * vmw_du_vblank_init - Set up the synthetic vblank source of a unit.
+ *
+ * @du: The display unit.
+ */
+void vmw_du_vblank_init(struct vmw_display_unit *du)
+{
+	spin_lock_init(&du->vblank_lock);
+	hrtimer_init(&du->vblank_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	du->vblank_timer.function = vmw_du_vblank_fn;
+	du->vblank_epoch = ktime_get();
+	du->vblank_base = 0;
+	du->vblank_period_ns = 0;
+	du->vblank_enabled = false;
+	du->vblank_running = false;
+}
+
+/**
+ * vmw_du_vblank_mode_set - Retime the vblank source after a mode set.
+ *
+ * @du: The display unit.
+ * @mode: The new mode, or NULL if the unit was turned off.
+ *
+ * The counter carries on from its current value at the new rate. A unit
+ * that is turned off keeps its counter but stops generating vblanks.
+ */
+void vmw_du_vblank_mode_set(struct vmw_display_unit *du,
+			    struct drm_display_mode *mode)
+{
+	unsigned long irq_flags;
+	ktime_t now;
+	int refresh = 0;
+
+	if (mode) {
+		refresh = drm_mode_vrefresh(mode);
+		if (refresh <= 0)
+			refresh = VMW_VBLANK_DEFAULT_HZ;
+	}
+
+	spin_lock_irqsave(&du->vblank_lock, irq_flags);
+	now = ktime_get();
+	du->vblank_base = vmw_du_vblank_count_locked(du, now);
+	du->vblank_epoch = now;
+	du->vblank_period_ns = refresh ? div_u64(NSEC_PER_SEC, refresh) : 0;
+
+	/*
+	 * A running timer picks up the new period on its next expiry.
+	 */
+	if (du->vblank_enabled && du->vblank_period_ns != 0 &&
+	    !du->vblank_running) {
+		du->vblank_running = true;
+		vmw_du_vblank_arm_locked(du, now);
+		hrtimer_start(&du->vblank_timer,
+			      hrtimer_get_expires(&du->vblank_timer),
+			      HRTIMER_MODE_ABS);
+	}
+	spin_unlock_irqrestore(&du->vblank_lock, irq_flags);
+}
+
+/**
+ * vmw_du_vblank_cleanup - Stop the synthetic vblank source of a unit.
+ *
+ * @du: The display unit.
+ */
+void vmw_du_vblank_cleanup(struct vmw_display_unit *du)
+{
+	unsigned long irq_flags;
+
+	spin_lock_irqsave(&du->vblank_lock, irq_flags);
+	du->vblank_enabled = false;
+	spin_unlock_irqrestore(&du->vblank_lock, irq_flags);
+
+	hrtimer_cancel(&du->vblank_timer);
+
+	spin_lock_irqsave(&du->vblank_lock, irq_flags);
+	du->vblank_running = false;
+	spin_unlock_irqrestore(&du->vblank_lock, irq_flags);
+}
+
 u32 vmw_get_vblank_counter(struct drm_device *dev, int crtc)
 {
-	return 0;
+	struct vmw_display_unit *du = vmw_du_from_index(dev, crtc);
+	unsigned long irq_flags;
+	u32 count;
+
+	if (unlikely(du == NULL))
+		return 0;
+
+	spin_lock_irqsave(&du->vblank_lock, irq_flags);
+	count = vmw_du_vblank_count_locked(du, ktime_get());
+	spin_unlock_irqrestore(&du->vblank_lock, irq_flags);
+
+	return count;
+}
+
+/**
+ * vmw_enable_vblank - Start generating vblanks on a crtc.
+ *
+ * Called by drm with dev->vbl_lock held when the first vblank
+ * reference is taken. Fails if the crtc has no mode set.
+ */
+int vmw_enable_vblank(struct drm_device *dev, int crtc)
+{
+	struct vmw_display_unit *du = vmw_du_from_index(dev, crtc);
+	unsigned long irq_flags;
+	int ret = 0;
+
+	if (unlikely(du == NULL))
+		return -EINVAL;
+
+	spin_lock_irqsave(&du->vblank_lock, irq_flags);
+	if (du->vblank_period_ns == 0) {
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	du->vblank_enabled = true;
+	if (!du->vblank_running) {
+		du->vblank_running = true;
+		vmw_du_vblank_arm_locked(du, ktime_get());
+		hrtimer_start(&du->vblank_timer,
+			      hrtimer_get_expires(&du->vblank_timer),
+			      HRTIMER_MODE_ABS);
+	}
+out_unlock:
+	spin_unlock_irqrestore(&du->vblank_lock, irq_flags);
+
+	return ret;
+}
+
+/**
+ * vmw_disable_vblank - Stop generating vblanks on a crtc.
+ *
+ * Called by drm some time after the last vblank reference is dropped.
+ */
+void vmw_disable_vblank(struct drm_device *dev, int crtc)
+{
+	struct vmw_display_unit *du = vmw_du_from_index(dev, crtc);
+
+	if (unlikely(du == NULL))
+		return;
+
+	vmw_du_vblank_cleanup(du);
 }
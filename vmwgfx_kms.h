@@ -40,16 +40,21 @@
  *
  * @pin is called the when ever a crtc uses this framebuffer
  * @unpin is called
+ * @dmabuf is true if the framebuffer is backed by a dma buffer rather
+ * than by a surface.
  */
 struct vmw_framebuffer {
 	struct drm_framebuffer base;
 	int (*pin)(struct vmw_framebuffer *fb);
 	int (*unpin)(struct vmw_framebuffer *fb);
+	bool dmabuf;
 };
 
 
 #define vmw_crtc_to_du(x) \
 	container_of(x, struct vmw_display_unit, crtc)
+#define vmw_connector_to_du(x) \
+	container_of(x, struct vmw_display_unit, connector)
 
 /*
  * Basic cursor manipulation
@@ -83,6 +88,31 @@ struct vmw_display_unit {
 	int hotspot_y;
 
 	unsigned unit;
+
+	unsigned pref_width;
+	unsigned pref_height;
+	bool pref_active;
+	struct drm_display_mode *pref_mode;
+
+	/*
+	 * Inputs the connector mode list was last built from.
+	 */
+	bool modes_valid;
+	unsigned modes_pref_width;
+	unsigned modes_pref_height;
+	uint32_t modes_max_width;
+	uint32_t modes_max_height;
+
+	/*
+	 * Synthetic vblank source, protected by vblank_lock.
+	 */
+	spinlock_t vblank_lock;
+	struct hrtimer vblank_timer;
+	ktime_t vblank_epoch;
+	u32 vblank_base;
+	u64 vblank_period_ns;
+	bool vblank_enabled;
+	bool vblank_running;
 };
 
 /*
@@ -92,6 +122,19 @@ void vmw_display_unit_cleanup(struct vmw_display_unit *du);
 int vmw_du_crtc_cursor_set(struct drm_crtc *crtc, struct drm_file *file_priv,
 			   uint32_t handle, uint32_t width, uint32_t height);
 int vmw_du_crtc_cursor_move(struct drm_crtc *crtc, int x, int y);
+enum drm_connector_status
+vmw_du_connector_detect(struct drm_connector *connector);
+int vmw_du_connector_fill_modes(struct drm_connector *connector,
+				uint32_t max_width, uint32_t max_height);
+void vmw_du_vblank_init(struct vmw_display_unit *du);
+void vmw_du_vblank_mode_set(struct vmw_display_unit *du,
+			    struct drm_display_mode *mode);
+void vmw_du_vblank_cleanup(struct vmw_display_unit *du);
+int vmw_kms_sou_update_fb(struct vmw_private *dev_priv,
+			  struct vmw_framebuffer *vfb,
+			  struct drm_clip_rect *clips,
+			  unsigned num_clips,
+			  struct vmw_fence_obj **out_fence);
 
 /*
  * Legacy display unit functions - vmwgfx_ldu.c
@@ -101,4 +144,10 @@ int vmw_kms_close_legacy_display_system(struct vmw_private *dev_priv);
 int vmw_kms_ldu_update_layout(struct vmw_private *dev_priv, unsigned num,
 			      struct drm_vmw_rect *rects);
 
+/*
+ * Screen Objects display functions - vmwgfx_scrn.c
+ */
+int vmw_kms_init_screen_object_display(struct vmw_private *dev_priv);
+int vmw_kms_close_screen_object_display(struct vmw_private *dev_priv);
+
 #endif
@@ -43,6 +43,17 @@ struct vmw_legacy_display {
 	unsigned last_num_active;
 
 	struct vmw_framebuffer *fb;
+
+	/*
+	 * Mode and per unit topology last written to the device,
+	 * only to be trusted while dev_priv->topology_valid is set.
+	 */
+	unsigned svga_width;
+	unsigned svga_height;
+	unsigned svga_pitch;
+	unsigned svga_bpp;
+	unsigned svga_depth;
+	struct vmw_vga_topology_state committed[VMWGFX_LDU_NUM_DU];
 };
 
 /**
@@ -51,11 +62,6 @@ struct vmw_legacy_display {
 struct vmw_legacy_display_unit {
 	struct vmw_display_unit base;
 
-	unsigned pref_width;
-	unsigned pref_height;
-	bool pref_active;
-	struct drm_display_mode *pref_mode;
-
 	struct list_head active;
 };
 
@@ -99,12 +105,60 @@ static void vmw_ldu_crtc_destroy(struct drm_crtc *crtc)
 	vmw_ldu_destroy(vmw_crtc_to_ldu(crtc));
 }
 
+/**
+ * vmw_ldu_write_svga - Program the svga mode unless already set.
+ *
+ * @dev_priv: Pointer to the device private structure.
+ * @width: Width of the svga mode.
+ * @height: Height of the svga mode.
+ * @fb: Framebuffer providing pitch, bpp and depth.
+ *
+ * Each register write is a trip to the host, so skip the whole
+ * sequence if the device already has this mode programmed.
+ */
+static int vmw_ldu_write_svga(struct vmw_private *dev_priv,
+			      unsigned width, unsigned height,
+			      struct drm_framebuffer *fb)
+{
+	struct vmw_legacy_display *lds = dev_priv->ldu_priv;
+
+	if (dev_priv->topology_valid &&
+	    lds->svga_width == width &&
+	    lds->svga_height == height &&
+	    lds->svga_pitch == fb->pitch &&
+	    lds->svga_bpp == fb->bits_per_pixel &&
+	    lds->svga_depth == fb->depth)
+		return 0;
+
+	lds->svga_width = width;
+	lds->svga_height = height;
+	lds->svga_pitch = fb->pitch;
+	lds->svga_bpp = fb->bits_per_pixel;
+	lds->svga_depth = fb->depth;
+
+	return vmw_kms_write_svga(dev_priv, width, height, fb->pitch,
+				  fb->bits_per_pixel, fb->depth);
+}
+
+/**
+ * vmw_ldu_commit_list - Commit the active display units to the device.
+ *
+ * @dev_priv: Pointer to the device private structure.
+ *
+ * The new layout is diffed against the one last committed, and only
+ * the display units whose position, size or primary status changed
+ * are reprogrammed. Everything is rewritten if some other code path
+ * has touched the registers since the last commit.
+ */
 static int vmw_ldu_commit_list(struct vmw_private *dev_priv)
 {
 	struct vmw_legacy_display *lds = dev_priv->ldu_priv;
 	struct vmw_legacy_display_unit *entry;
+	struct vmw_vga_topology_state state;
 	struct drm_framebuffer *fb = NULL;
 	struct drm_crtc *crtc = NULL;
+	bool valid = dev_priv->topology_valid;
+	int ret = 0;
 	int i = 0;
 
 	/* If there is no display topology the host just assumes
@@ -123,34 +177,53 @@ static int vmw_ldu_commit_list(struct vmw_private *dev_priv)
 			return 0;
 		fb = entry->base.crtc.fb;
 
-		return vmw_kms_write_svga(dev_priv, w, h, fb->pitch,
-					  fb->bits_per_pixel, fb->depth);
+		ret = vmw_ldu_write_svga(dev_priv, w, h, fb);
+		dev_priv->topology_valid = (ret == 0);
+
+		return ret;
 	}
 
 	if (!list_empty(&lds->active)) {
 		entry = list_entry(lds->active.next, typeof(*entry), active);
 		fb = entry->base.crtc.fb;
 
-		vmw_kms_write_svga(dev_priv, fb->width, fb->height, fb->pitch,
-				   fb->bits_per_pixel, fb->depth);
+		ret = vmw_ldu_write_svga(dev_priv, fb->width, fb->height, fb);
 	}
 
 	/* Make sure we always show something. */
-	vmw_write(dev_priv, SVGA_REG_NUM_GUEST_DISPLAYS,
-		  lds->num_active ? lds->num_active : 1);
+	if (!valid || lds->num_active != lds->last_num_active)
+		vmw_write(dev_priv, SVGA_REG_NUM_GUEST_DISPLAYS,
+			  lds->num_active ? lds->num_active : 1);
 
 	i = 0;
 	list_for_each_entry(entry, &lds->active, active) {
 		crtc = &entry->base.crtc;
 
+		state.primary = !i;
+		state.pos_x = crtc->x;
+		state.pos_y = crtc->y;
+		state.width = crtc->mode.hdisplay;
+		state.height = crtc->mode.vdisplay;
+
+		/*
+		 * Units beyond the previously committed count are always
+		 * reprogrammed; their cached state may be stale.
+		 */
+		if (valid && i < lds->last_num_active &&
+		    memcmp(&lds->committed[i], &state, sizeof(state)) == 0) {
+			i++;
+			continue;
+		}
+
 		vmw_write(dev_priv, SVGA_REG_DISPLAY_ID, i);
-		vmw_write(dev_priv, SVGA_REG_DISPLAY_IS_PRIMARY, !i);
-		vmw_write(dev_priv, SVGA_REG_DISPLAY_POSITION_X, crtc->x);
-		vmw_write(dev_priv, SVGA_REG_DISPLAY_POSITION_Y, crtc->y);
-		vmw_write(dev_priv, SVGA_REG_DISPLAY_WIDTH, crtc->mode.hdisplay);
-		vmw_write(dev_priv, SVGA_REG_DISPLAY_HEIGHT, crtc->mode.vdisplay);
+		vmw_write(dev_priv, SVGA_REG_DISPLAY_IS_PRIMARY, state.primary);
+		vmw_write(dev_priv, SVGA_REG_DISPLAY_POSITION_X, state.pos_x);
+		vmw_write(dev_priv, SVGA_REG_DISPLAY_POSITION_Y, state.pos_y);
+		vmw_write(dev_priv, SVGA_REG_DISPLAY_WIDTH, state.width);
+		vmw_write(dev_priv, SVGA_REG_DISPLAY_HEIGHT, state.height);
 		vmw_write(dev_priv, SVGA_REG_DISPLAY_ID, SVGA_ID_INVALID);
 
+		lds->committed[i] = state;
 		i++;
 	}
 
@@ -158,6 +231,9 @@ static int vmw_ldu_commit_list(struct vmw_private *dev_priv)
 
 	lds->last_num_active = lds->num_active;
 
+	/* A failed mode set must not be cached as committed. */
+	dev_priv->topology_valid = (ret == 0);
+
 	return 0;
 }
 
@@ -271,6 +347,7 @@ static int vmw_ldu_crtc_set_config(struct drm_mode_set *set)
 		crtc->fb = NULL;
 
 		vmw_ldu_del_active(dev_priv, ldu);
+		vmw_du_vblank_mode_set(&ldu->base, NULL);
 
 		return vmw_ldu_commit_list(dev_priv);
 	}
@@ -296,6 +373,7 @@ static int vmw_ldu_crtc_set_config(struct drm_mode_set *set)
 	crtc->mode = *mode;
 
 	vmw_ldu_add_active(dev_priv, ldu, vfb);
+	vmw_du_vblank_mode_set(&ldu->base, &crtc->mode);
 
 	return vmw_ldu_commit_list(dev_priv);
 }
@@ -339,157 +417,6 @@ static void vmw_ldu_connector_restore(struct drm_connector *connector)
 {
 }
 
-static enum drm_connector_status
-	vmw_ldu_connector_detect(struct drm_connector *connector)
-{
-	uint32_t num_displays;
-	struct drm_device *dev = connector->dev;
-	struct vmw_private *dev_priv = vmw_priv(dev);
-
-	mutex_lock(&dev_priv->hw_mutex);
-	num_displays = vmw_read(dev_priv, SVGA_REG_NUM_DISPLAYS);
-	mutex_unlock(&dev_priv->hw_mutex);
-
-	return ((vmw_connector_to_ldu(connector)->base.unit < num_displays) ?
-		connector_status_connected : connector_status_disconnected);
-}
-
-static struct drm_display_mode vmw_ldu_connector_builtin[] = {
-	/* 640x480@60Hz */
-	{ DRM_MODE("640x480", DRM_MODE_TYPE_DRIVER, 25175, 640, 656,
-		   752, 800, 0, 480, 489, 492, 525, 0,
-		   DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_NVSYNC) },
-	/* 800x600@60Hz */
-	{ DRM_MODE("800x600", DRM_MODE_TYPE_DRIVER, 40000, 800, 840,
-		   968, 1056, 0, 600, 601, 605, 628, 0,
-		   DRM_MODE_FLAG_PHSYNC | DRM_MODE_FLAG_PVSYNC) },
-	/* 1024x768@60Hz */
-	{ DRM_MODE("1024x768", DRM_MODE_TYPE_DRIVER, 65000, 1024, 1048,
-		   1184, 1344, 0, 768, 771, 777, 806, 0,
-		   DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_NVSYNC) },
-	/* 1152x864@75Hz */
-	{ DRM_MODE("1152x864", DRM_MODE_TYPE_DRIVER, 108000, 1152, 1216,
-		   1344, 1600, 0, 864, 865, 868, 900, 0,
-		   DRM_MODE_FLAG_PHSYNC | DRM_MODE_FLAG_PVSYNC) },
-	/* 1280x768@60Hz */
-	{ DRM_MODE("1280x768", DRM_MODE_TYPE_DRIVER, 79500, 1280, 1344,
-		   1472, 1664, 0, 768, 771, 778, 798, 0,
-		   DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_PVSYNC) },
-	/* 1280x800@60Hz */
-	{ DRM_MODE("1280x800", DRM_MODE_TYPE_DRIVER, 83500, 1280, 1352,
-		   1480, 1680, 0, 800, 803, 809, 831, 0,
-		   DRM_MODE_FLAG_PHSYNC | DRM_MODE_FLAG_NVSYNC) },
-	/* 1280x960@60Hz */
-	{ DRM_MODE("1280x960", DRM_MODE_TYPE_DRIVER, 108000, 1280, 1376,
-		   1488, 1800, 0, 960, 961, 964, 1000, 0,
-		   DRM_MODE_FLAG_PHSYNC | DRM_MODE_FLAG_PVSYNC) },
-	/* 1280x1024@60Hz */
-	{ DRM_MODE("1280x1024", DRM_MODE_TYPE_DRIVER, 108000, 1280, 1328,
-		   1440, 1688, 0, 1024, 1025, 1028, 1066, 0,
-		   DRM_MODE_FLAG_PHSYNC | DRM_MODE_FLAG_PVSYNC) },
-	/* 1360x768@60Hz */
-	{ DRM_MODE("1360x768", DRM_MODE_TYPE_DRIVER, 85500, 1360, 1424,
-		   1536, 1792, 0, 768, 771, 777, 795, 0,
-		   DRM_MODE_FLAG_PHSYNC | DRM_MODE_FLAG_PVSYNC) },
-	/* 1440x1050@60Hz */
-	{ DRM_MODE("1400x1050", DRM_MODE_TYPE_DRIVER, 121750, 1400, 1488,
-		   1632, 1864, 0, 1050, 1053, 1057, 1089, 0,
-		   DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_PVSYNC) },
-	/* 1440x900@60Hz */
-	{ DRM_MODE("1440x900", DRM_MODE_TYPE_DRIVER, 106500, 1440, 1520,
-		   1672, 1904, 0, 900, 903, 909, 934, 0,
-		   DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_PVSYNC) },
-	/* 1600x1200@60Hz */
-	{ DRM_MODE("1600x1200", DRM_MODE_TYPE_DRIVER, 162000, 1600, 1664,
-		   1856, 2160, 0, 1200, 1201, 1204, 1250, 0,
-		   DRM_MODE_FLAG_PHSYNC | DRM_MODE_FLAG_PVSYNC) },
-	/* 1680x1050@60Hz */
-	{ DRM_MODE("1680x1050", DRM_MODE_TYPE_DRIVER, 146250, 1680, 1784,
-		   1960, 2240, 0, 1050, 1053, 1059, 1089, 0,
-		   DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_PVSYNC) },
-	/* 1792x1344@60Hz */
-	{ DRM_MODE("1792x1344", DRM_MODE_TYPE_DRIVER, 204750, 1792, 1920,
-		   2120, 2448, 0, 1344, 1345, 1348, 1394, 0,
-		   DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_PVSYNC) },
-	/* 1853x1392@60Hz */
-	{ DRM_MODE("1856x1392", DRM_MODE_TYPE_DRIVER, 218250, 1856, 1952,
-		   2176, 2528, 0, 1392, 1393, 1396, 1439, 0,
-		   DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_PVSYNC) },
-	/* 1920x1200@60Hz */
-	{ DRM_MODE("1920x1200", DRM_MODE_TYPE_DRIVER, 193250, 1920, 2056,
-		   2256, 2592, 0, 1200, 1203, 1209, 1245, 0,
-		   DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_PVSYNC) },
-	/* 1920x1440@60Hz */
-	{ DRM_MODE("1920x1440", DRM_MODE_TYPE_DRIVER, 234000, 1920, 2048,
-		   2256, 2600, 0, 1440, 1441, 1444, 1500, 0,
-		   DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_PVSYNC) },
-	/* 2560x1600@60Hz */
-	{ DRM_MODE("2560x1600", DRM_MODE_TYPE_DRIVER, 348500, 2560, 2752,
-		   3032, 3504, 0, 1600, 1603, 1609, 1658, 0,
-		   DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_PVSYNC) },
-	/* Terminate */
-	{ DRM_MODE("", 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0) },
-};
-
-static int vmw_ldu_connector_fill_modes(struct drm_connector *connector,
-					uint32_t max_width, uint32_t max_height)
-{
-	struct vmw_legacy_display_unit *ldu = vmw_connector_to_ldu(connector);
-	struct drm_device *dev = connector->dev;
-	struct vmw_private *dev_priv = vmw_priv(dev);
-	struct drm_display_mode *mode = NULL;
-	struct drm_display_mode *bmode;
-        struct drm_display_mode prefmode = { DRM_MODE("preferred",
-		DRM_MODE_TYPE_DRIVER | DRM_MODE_TYPE_PREFERRED,
-		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_PVSYNC)
-	};
-	int i;
-
-	/* Add preferred mode */
-	{
-		mode = drm_mode_duplicate(dev, &prefmode);
-		if (!mode)
-			return 0;
-		mode->hdisplay = ldu->pref_width;
-		mode->vdisplay = ldu->pref_height;
-		mode->vrefresh = drm_mode_vrefresh(mode);
-		if (vmw_kms_validate_mode_vram(dev_priv, mode->hdisplay * 2,
-					       mode->vdisplay)) {
-			drm_mode_probed_add(connector, mode);
-
-			if (ldu->pref_mode) {
-				list_del_init(&ldu->pref_mode->head);
-				drm_mode_destroy(dev, ldu->pref_mode);
-			}
-
-			ldu->pref_mode = mode;
-		}
-	}
-
-	for (i = 0; vmw_ldu_connector_builtin[i].type != 0; i++) {
-		bmode = &vmw_ldu_connector_builtin[i];
-		if (bmode->hdisplay > max_width ||
-		    bmode->vdisplay > max_height)
-			continue;
-
-		if (!vmw_kms_validate_mode_vram(dev_priv, bmode->hdisplay * 2,
-						bmode->vdisplay))
-			continue;
-
-		mode = drm_mode_duplicate(dev, bmode);
-		if (!mode)
-			return 0;
-		mode->vrefresh = drm_mode_vrefresh(mode);
-
-		drm_mode_probed_add(connector, mode);
-	}
-
-	drm_mode_connector_list_update(connector);
-
-	return 1;
-}
-
 static int vmw_ldu_connector_set_property(struct drm_connector *connector,
 					  struct drm_property *property,
 					  uint64_t val)
@@ -506,8 +433,8 @@ static struct drm_connector_funcs vmw_legacy_connector_funcs = {
 	.dpms = vmw_ldu_connector_dpms,
 	.save = vmw_ldu_connector_save,
 	.restore = vmw_ldu_connector_restore,
-	.detect = vmw_ldu_connector_detect,
-	.fill_modes = vmw_ldu_connector_fill_modes,
+	.detect = vmw_du_connector_detect,
+	.fill_modes = vmw_du_connector_fill_modes,
 	.set_property = vmw_ldu_connector_set_property,
 	.destroy = vmw_ldu_connector_destroy,
 };
@@ -531,14 +458,15 @@ static int vmw_ldu_init(struct vmw_private *dev_priv, unsigned unit)
 
 	INIT_LIST_HEAD(&ldu->active);
 
-	ldu->pref_active = (unit == 0);
-	ldu->pref_width = 800;
-	ldu->pref_height = 600;
-	ldu->pref_mode = NULL;
+	ldu->base.pref_active = (unit == 0);
+	ldu->base.pref_width = 800;
+	ldu->base.pref_height = 600;
+	ldu->base.pref_mode = NULL;
+	ldu->base.modes_valid = false;
 
 	drm_connector_init(dev, connector, &vmw_legacy_connector_funcs,
 			   DRM_MODE_CONNECTOR_LVDS);
-	connector->status = vmw_ldu_connector_detect(connector);
+	connector->status = vmw_du_connector_detect(connector);
 
 	drm_encoder_init(dev, encoder, &vmw_legacy_encoder_funcs,
 			 DRM_MODE_ENCODER_LVDS);
@@ -546,6 +474,7 @@ static int vmw_ldu_init(struct vmw_private *dev_priv, unsigned unit)
 	encoder->possible_crtcs = (1 << unit);
 	encoder->possible_clones = 0;
 
+	vmw_du_vblank_init(&ldu->base);
 	drm_crtc_init(dev, crtc, &vmw_legacy_crtc_funcs);
 
 	drm_mode_crtc_set_gamma_size(crtc, 256);
@@ -577,6 +506,7 @@ int vmw_kms_init_legacy_display_system(struct vmw_private *dev_priv)
 	dev_priv->ldu_priv->num_active = 0;
 	dev_priv->ldu_priv->last_num_active = 0;
 	dev_priv->ldu_priv->fb = NULL;
+	dev_priv->topology_valid = false;
 
 	drm_mode_create_dirty_info_property(dev_priv->dev);
 
@@ -590,6 +520,9 @@ int vmw_kms_init_legacy_display_system(struct vmw_private *dev_priv)
 		ret = drm_vblank_init(dev, 1);
 	}
 
+	/* Let idle crtcs stop their vblank timers. */
+	dev->vblank_disable_allowed = 1;
+
 	return ret;
 }
 
@@ -631,15 +564,15 @@ int vmw_kms_ldu_update_layout(struct vmw_private *dev_priv, unsigned num,
 	list_for_each_entry(con, &dev->mode_config.connector_list, head) {
 		ldu = vmw_connector_to_ldu(con);
 		if (num > ldu->base.unit) {
-			ldu->pref_width = rects[ldu->base.unit].w;
-			ldu->pref_height = rects[ldu->base.unit].h;
-			ldu->pref_active = true;
+			ldu->base.pref_width = rects[ldu->base.unit].w;
+			ldu->base.pref_height = rects[ldu->base.unit].h;
+			ldu->base.pref_active = true;
 		} else {
-			ldu->pref_width = 800;
-			ldu->pref_height = 600;
-			ldu->pref_active = false;
+			ldu->base.pref_width = 800;
+			ldu->base.pref_height = 600;
+			ldu->base.pref_active = false;
 		}
-		con->status = vmw_ldu_connector_detect(con);
+		con->status = vmw_du_connector_detect(con);
 	}
 
 	mutex_unlock(&dev->mode_config.mutex);
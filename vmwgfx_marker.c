@@ -27,145 +27,301 @@
 
 
 #include "vmwgfx_drv.h"
+#include "vmwgfx_trace.h"
 
-struct vmw_marker {
-	struct list_head head;
-	uint32_t seqno;
-	struct timespec submitted;
-};
+/*
+ * Seqnos further apart than this are considered to be in the past.
+ */
+#define VMW_MARKER_WRAP (1 << 30)
+
+static inline u64 vmw_marker_now(void)
+{
+	struct timespec now;
+
+	getrawmonotonic(&now);
+	return (u64) timespec_to_ns(&now);
+}
+
+static inline struct vmw_marker *vmw_marker_slot(struct vmw_marker_queue *queue,
+						 uint32_t seqno)
+{
+	return &queue->ring[seqno & (VMW_MARKER_RING_SIZE - 1)];
+}
+
+/**
+ * vmw_marker_read - Read the submission time of a marker.
+ *
+ * @marker: The ring slot to read.
+ * @seqno: The seqno we expect to find in the slot.
+ * @submitted: Returns the submission time.
+ *
+ * Returns true if the slot holds a marker for @seqno. The seqno is
+ * re-read after the timestamp so that a concurrent overwrite of the
+ * slot is detected.
+ */
+static bool vmw_marker_read(struct vmw_marker *marker, uint32_t seqno,
+			    u64 *submitted)
+{
+	if (ACCESS_ONCE(marker->seqno) != seqno)
+		return false;
+	smp_rmb();
+	*submitted = marker->submitted;
+	smp_rmb();
+	return (ACCESS_ONCE(marker->seqno) == seqno);
+}
+
+static bool vmw_marker_pending(struct vmw_marker_queue *queue)
+{
+	uint32_t seqno = (uint32_t) atomic_read(&queue->retired) + 1;
+	u64 submitted;
+
+	if (ACCESS_ONCE(queue->lost))
+		return true;
+
+	if (seqno == 0)
+		seqno = 1;
+
+	return vmw_marker_read(vmw_marker_slot(queue, seqno), seqno,
+			       &submitted);
+}
 
-void vmw_marker_queue_init(struct vmw_marker_queue *queue)
+void vmw_marker_queue_init(struct vmw_marker_queue *queue,
+			   uint32_t seqno)
 {
-	INIT_LIST_HEAD(&queue->head);
-	queue->lag = ns_to_timespec(0);
-	getrawmonotonic(&queue->lag_time);
+	memset(queue->ring, 0, sizeof(queue->ring));
+	atomic_set(&queue->retired, (int) seqno);
+	queue->lag = 0;
+	queue->lag_time = vmw_marker_now();
+	queue->last_retire = queue->lag_time;
+	queue->avg_lag = 0;
+	queue->avg_interval = 0;
+	queue->lost = false;
+	queue->lost_seqno = 0;
+	queue->lost_submitted = 0;
 	spin_lock_init(&queue->lock);
 }
 
 void vmw_marker_queue_takedown(struct vmw_marker_queue *queue)
 {
-	struct vmw_marker *marker, *next;
-
-	spin_lock(&queue->lock);
-	list_for_each_entry_safe(marker, next, &queue->head, head) {
-		kfree(marker);
-	}
-	spin_unlock(&queue->lock);
+	memset(queue->ring, 0, sizeof(queue->ring));
 }
 
+/**
+ * vmw_marker_push - Record the submission time of a seqno.
+ *
+ * @queue: The marker queue.
+ * @seqno: The seqno just submitted.
+ *
+ * Each seqno has its own ring slot, so concurrent pushes don't need to
+ * be ordered. If more than VMW_MARKER_RING_SIZE markers are outstanding,
+ * the oldest ones are overwritten. The submission time of the oldest
+ * overwritten marker is kept aside until it has retired, so that the
+ * queue isn't mistaken for idle and throttling keeps working.
+ */
 int vmw_marker_push(struct vmw_marker_queue *queue,
 		   uint32_t seqno)
 {
-	struct vmw_marker *marker = kmalloc(sizeof(*marker), GFP_KERNEL);
+	struct vmw_marker *marker = vmw_marker_slot(queue, seqno);
+	uint32_t old_seqno = marker->seqno;
 
-	if (unlikely(!marker))
-		return -ENOMEM;
+	if (unlikely(old_seqno != 0 &&
+		     old_seqno - (uint32_t) atomic_read(&queue->retired) - 1 <
+		     VMW_MARKER_WRAP)) {
+		spin_lock(&queue->lock);
+		if (!queue->lost) {
+			queue->lost_submitted = marker->submitted;
+			queue->lost_seqno = old_seqno;
+			queue->lost = true;
+		} else if (old_seqno - queue->lost_seqno < VMW_MARKER_WRAP)
+			queue->lost_seqno = old_seqno;
+		spin_unlock(&queue->lock);
+	}
 
+	marker->seqno = 0;
+	smp_wmb();
+	marker->submitted = vmw_marker_now();
+	smp_wmb();
 	marker->seqno = seqno;
-	getrawmonotonic(&marker->submitted);
-	spin_lock(&queue->lock);
-	list_add_tail(&marker->head, &queue->head);
-	spin_unlock(&queue->lock);
 
 	return 0;
 }
 
+/**
+ * vmw_marker_pull - Retire markers up to and including a signaled seqno.
+ *
+ * @queue: The marker queue.
+ * @signaled_seqno: The last seqno signaled by the device.
+ *
+ * Only the seqnos retired since the last call are looked at. The caller
+ * that advances @queue->retired owns that range, so several callers may
+ * run concurrently. The lag of the newest retired marker, together with
+ * the averages, are then updated under the queue lock.
+ */
 int vmw_marker_pull(struct vmw_marker_queue *queue,
 		   uint32_t signaled_seqno)
 {
-	struct vmw_marker *marker, *next;
-	struct timespec now;
+	uint32_t old, prev, first, seqno;
+	uint32_t count = 0;
+	u64 submitted;
+	u64 latest = 0;
+	u64 now, interval;
 	bool updated = false;
 
+	old = (uint32_t) atomic_read(&queue->retired);
+	for (;;) {
+		if (signaled_seqno - old - 1 >= VMW_MARKER_WRAP) {
+			old = signaled_seqno;
+			break;
+		}
+		prev = (uint32_t) atomic_cmpxchg(&queue->retired, (int) old,
+						 (int) signaled_seqno);
+		if (prev == old)
+			break;
+		old = prev;
+	}
+
+	if (old != signaled_seqno) {
+		first = old + 1;
+		if (signaled_seqno - old > VMW_MARKER_RING_SIZE)
+			first = signaled_seqno - VMW_MARKER_RING_SIZE + 1;
+
+		for (seqno = first; ; ++seqno) {
+			if (seqno != 0 &&
+			    vmw_marker_read(vmw_marker_slot(queue, seqno),
+					    seqno, &submitted)) {
+				latest = submitted;
+				++count;
+			}
+			if (seqno == signaled_seqno)
+				break;
+		}
+	}
+
 	spin_lock(&queue->lock);
-	getrawmonotonic(&now);
+	now = vmw_marker_now();
 
-	if (list_empty(&queue->head)) {
-		queue->lag = ns_to_timespec(0);
-		queue->lag_time = now;
-		updated = true;
-		goto out_unlock;
+	if (queue->lost && old != signaled_seqno) {
+		/*
+		 * Retired seqnos whose slots were overwritten are accounted
+		 * with the oldest lost submission time.
+		 */
+		if (count == 0) {
+			latest = queue->lost_submitted;
+			count = signaled_seqno - old;
+		}
+		if (signaled_seqno - queue->lost_seqno < VMW_MARKER_WRAP)
+			queue->lost = false;
 	}
 
-	list_for_each_entry_safe(marker, next, &queue->head, head) {
-		if (signaled_seqno - marker->seqno > (1 << 30))
-			continue;
+	if (count != 0) {
+		queue->lag = (now > latest) ? now - latest : 0;
+		queue->lag_time = now;
+		queue->avg_lag = queue->avg_lag - (queue->avg_lag >> 3) +
+			(queue->lag >> 3);
 
-		queue->lag = timespec_sub(now, marker->submitted);
+		interval = now - queue->last_retire;
+		do_div(interval, count);
+		queue->avg_interval = queue->avg_interval -
+			(queue->avg_interval >> 3) + (interval >> 3);
+		queue->last_retire = now;
+		updated = true;
+	} else if (!vmw_marker_pending(queue)) {
+		queue->lag = 0;
 		queue->lag_time = now;
 		updated = true;
-		list_del(&marker->head);
-		kfree(marker);
 	}
 
-out_unlock:
 	spin_unlock(&queue->lock);
 
 	return (updated) ? 0 : -EBUSY;
 }
 
-static struct timespec vmw_timespec_add(struct timespec t1,
-					struct timespec t2)
+static u64 vmw_fifo_lag(struct vmw_marker_queue *queue)
 {
-	t1.tv_sec += t2.tv_sec;
-	t1.tv_nsec += t2.tv_nsec;
-	if (t1.tv_nsec >= 1000000000L) {
-		t1.tv_sec += 1;
-		t1.tv_nsec -= 1000000000L;
-	}
-
-	return t1;
-}
-
-static struct timespec vmw_fifo_lag(struct vmw_marker_queue *queue)
-{
-	struct timespec now;
+	u64 lag;
 
 	spin_lock(&queue->lock);
-	getrawmonotonic(&now);
-	queue->lag = vmw_timespec_add(queue->lag,
-				      timespec_sub(now, queue->lag_time));
-	queue->lag_time = now;
+	lag = queue->lag + (vmw_marker_now() - queue->lag_time);
 	spin_unlock(&queue->lock);
-	return queue->lag;
-}
 
+	return lag;
+}
 
 static bool vmw_lag_lt(struct vmw_marker_queue *queue,
 		       uint32_t us)
 {
-	struct timespec lag, cond;
-
-	cond = ns_to_timespec((s64) us * 1000);
-	lag = vmw_fifo_lag(queue);
-	return (timespec_compare(&lag, &cond) < 1);
+	return vmw_fifo_lag(queue) <= (u64) us * 1000ULL;
 }
 
 int vmw_wait_lag(struct vmw_private *dev_priv,
 		 struct vmw_marker_queue *queue, uint32_t us)
 {
-	struct vmw_marker *marker;
 	uint32_t seqno;
-	int ret;
+	int ret = 0;
+	ktime_t start;
+
+	if (vmw_lag_lt(queue, us))
+		return 0;
 
+	start = ktime_get();
 	while (!vmw_lag_lt(queue, us)) {
-		spin_lock(&queue->lock);
-		if (list_empty(&queue->head))
+		if (vmw_marker_pending(queue)) {
+			seqno = (uint32_t) atomic_read(&queue->retired) + 1;
+			if (seqno == 0)
+				seqno = 1;
+		} else
 			seqno = atomic_read(&dev_priv->marker_seq);
-		else {
-			marker = list_first_entry(&queue->head,
-						 struct vmw_marker, head);
-			seqno = marker->seqno;
-		}
-		spin_unlock(&queue->lock);
 
 		ret = vmw_wait_seqno(dev_priv, false, seqno, true,
 					3*HZ);
 
 		if (unlikely(ret != 0))
-			return ret;
+			break;
 
 		(void) vmw_marker_pull(queue, seqno);
 	}
-	return 0;
+
+	trace_vmw_wait(VMW_WAIT_LAG, us, ret,
+		       ktime_to_ns(ktime_sub(ktime_get(), start)));
+	return ret;
+}
+
+/**
+ * vmw_marker_fence_latency - Average submit-to-retire time of fences.
+ *
+ * @queue: The marker queue.
+ *
+ * Returns an exponentially weighted average of the lag in nanoseconds.
+ * This is a cheap estimate of the device queue depth.
+ */
+u64 vmw_marker_fence_latency(struct vmw_marker_queue *queue)
+{
+	u64 lag;
+
+	spin_lock(&queue->lock);
+	lag = queue->avg_lag;
+	spin_unlock(&queue->lock);
+
+	return lag;
+}
+
+/**
+ * vmw_marker_fence_rate - Average number of fences retired per second.
+ *
+ * @queue: The marker queue.
+ */
+u64 vmw_marker_fence_rate(struct vmw_marker_queue *queue)
+{
+	u64 rate = 1000000000ULL;
+	u64 interval;
+
+	spin_lock(&queue->lock);
+	interval = queue->avg_interval;
+	spin_unlock(&queue->lock);
+
+	if (interval == 0)
+		return 0;
+
+	do_div(rate, (uint32_t) min_t(u64, interval, 0xFFFFFFFFULL));
+	return rate;
 }
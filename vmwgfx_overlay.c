@@ -35,12 +35,47 @@
 #include "svga_escape.h"
 
 #define VMW_MAX_NUM_STREAMS 1
+#define VMW_STREAM_NUM_FRAMES 3
+
+/**
+ * A buffer kept pinned in vram for a stream, so that the stream can flip
+ * between its frames without re-validating them.
+ *
+ * @buf: The pinned buffer, referenced. NULL if the slot is free.
+ * @retire_fence: Fence of the put that moved the stream away from this
+ * buffer. The buffer may be unpinned once it has signaled.
+ * @last_used: Stream put counter value when the buffer was last shown.
+ */
+struct vmw_stream_frame {
+	struct vmw_dma_buffer *buf;
+	struct vmw_fence_obj *retire_fence;
+	unsigned long last_used;
+};
 
 struct vmw_stream {
 	struct vmw_dma_buffer *buf;
 	bool claimed;
 	bool paused;
 	struct drm_vmw_control_stream_arg saved;
+	struct vmw_stream_frame frames[VMW_STREAM_NUM_FRAMES];
+	unsigned long num_puts;
+	/* Fence of the last command sent for this stream. */
+	struct vmw_fence_obj *fence;
+	/* Register values last sent to the host, if regs_valid. */
+	uint32_t regs[SVGA_VIDEO_NUM_REGS];
+	bool regs_valid;
+};
+
+/**
+ * A pending put command for a stream, used to batch several streams'
+ * updates into a single fifo reservation.
+ */
+struct vmw_overlay_put {
+	struct vmw_stream *stream;
+	struct vmw_dma_buffer *buf;
+	struct drm_vmw_control_stream_arg *arg;
+	struct vmw_stream_frame *frame;
+	bool new_frame;
 };
 
 /**
@@ -129,37 +164,117 @@ err:
 }
 
 /**
- * Send put command to hw.
+ * Release a frame slot, waiting for the host to stop reading from it
+ * before removing the no evict flag.
+ */
+static void vmw_stream_frame_release(struct vmw_private *dev_priv,
+				     struct vmw_stream_frame *frame)
+{
+	if (!frame->buf)
+		return;
+
+	if (frame->retire_fence) {
+		(void) vmw_fence_obj_wait(frame->retire_fence,
+					  DRM_VMW_FENCE_FLAG_EXEC, true, false,
+					  VMW_FENCE_WAIT_TIMEOUT);
+		vmw_fence_obj_unreference(&frame->retire_fence);
+	}
+
+	/* We just remove the NO_EVICT flag so no -ENOMEM */
+	BUG_ON(vmw_dmabuf_pin_in_vram(dev_priv, frame->buf, false, false) != 0);
+	vmw_dmabuf_unreference(&frame->buf);
+}
+
+static struct vmw_stream_frame *
+vmw_stream_frame_find(struct vmw_stream *stream, struct vmw_dma_buffer *buf)
+{
+	int i;
+
+	for (i = 0; i < VMW_STREAM_NUM_FRAMES; i++)
+		if (stream->frames[i].buf == buf)
+			return &stream->frames[i];
+
+	return NULL;
+}
+
+/**
+ * Pin a new buffer in vram and add it to the stream's frames. If all
+ * slots are taken, the least recently shown frame that isn't currently
+ * displayed is released.
  *
  * Returns
- * -ERESTARTSYS if interrupted by a signal.
+ * -ENOMEM if buffer doesn't fit in vram.
+ * -ERESTARTSYS if interrupted.
  */
-static int vmw_overlay_send_put(struct vmw_private *dev_priv,
+static int vmw_stream_frame_add(struct vmw_private *dev_priv,
+				struct vmw_stream *stream,
 				struct vmw_dma_buffer *buf,
-				struct drm_vmw_control_stream_arg *arg,
-				bool interruptible)
+				bool interruptible,
+				struct vmw_stream_frame **out)
 {
-	struct {
-		struct vmw_escape_header escape;
-		struct {
-			struct {
-				uint32_t cmdType;
-				uint32_t streamId;
-			} header;
-			struct {
-				uint32_t registerId;
-				uint32_t value;
-			} items[SVGA_VIDEO_PITCH_3 + 1];
-		} body;
-		struct vmw_escape_video_flush flush;
-	} *cmds;
-	uint32_t offset;
+	struct vmw_stream_frame *frame = NULL;
+	struct vmw_stream_frame *cur;
 	int i, ret;
 
-	for (;;) {
-		cmds = vmw_fifo_reserve(dev_priv, sizeof(*cmds));
-		if (cmds)
+	for (i = 0; i < VMW_STREAM_NUM_FRAMES; i++) {
+		cur = &stream->frames[i];
+		if (!cur->buf) {
+			frame = cur;
 			break;
+		}
+		if (cur->buf == stream->buf)
+			continue;
+		if (!frame || cur->last_used < frame->last_used)
+			frame = cur;
+	}
+
+	BUG_ON(frame == NULL);
+	vmw_stream_frame_release(dev_priv, frame);
+
+	ret = vmw_dmabuf_pin_in_vram(dev_priv, buf, true, interruptible);
+	if (ret)
+		return ret;
+
+	frame->buf = vmw_dmabuf_reference(buf);
+	frame->last_used = 0;
+	*out = frame;
+
+	return 0;
+}
+
+/**
+ * Reserve fifo space for a stream command.
+ *
+ * Backpressure comes from the stream's own last command: if the fifo is
+ * full we wait for that to retire rather than for the whole fifo to go
+ * idle. Only a stream without outstanding commands falls back to the
+ * fifo idle wait.
+ *
+ * Returns
+ * -ERESTARTSYS if interrupted by a signal.
+ */
+static int vmw_overlay_fifo_reserve(struct vmw_private *dev_priv,
+				    struct vmw_stream *stream,
+				    uint32_t size, bool interruptible,
+				    void **cmds)
+{
+	int ret;
+
+	for (;;) {
+		*cmds = vmw_fifo_reserve(dev_priv, size);
+		if (*cmds)
+			return 0;
+
+		if (stream->fence) {
+			ret = vmw_fence_obj_wait(stream->fence,
+						 DRM_VMW_FENCE_FLAG_EXEC,
+						 true, interruptible,
+						 VMW_FENCE_WAIT_TIMEOUT);
+			if (interruptible && ret == -ERESTARTSYS)
+				return ret;
+			vmw_fence_obj_unreference(&stream->fence);
+			continue;
+		}
 
 		ret = vmw_fallback_wait(dev_priv, false, true, 0,
 					interruptible, 3*HZ);
@@ -168,39 +283,168 @@ static int vmw_overlay_send_put(struct vmw_private *dev_priv,
 		else
 			BUG_ON(ret != 0);
 	}
+}
 
-	fill_escape(&cmds->escape, sizeof(cmds->body));
-	cmds->body.header.cmdType = SVGA_ESCAPE_VMWARE_VIDEO_SET_REGS;
-	cmds->body.header.streamId = arg->stream_id;
+/**
+ * Fence the command just committed for a stream.
+ */
+static void vmw_overlay_fence(struct vmw_private *dev_priv,
+			      struct vmw_stream *stream)
+{
+	if (stream->fence)
+		vmw_fence_obj_unreference(&stream->fence);
+
+	(void) vmw_execbuf_fence_commands(NULL, dev_priv, &stream->fence,
+					  NULL);
+}
+
+/**
+ * Compute the register values for a put and return a bitmask of the
+ * registers that differ from what the host already has.
+ */
+static uint32_t vmw_overlay_put_regs(struct vmw_overlay_put *put,
+				     uint32_t *values)
+{
+	struct drm_vmw_control_stream_arg *arg = put->arg;
+	struct vmw_stream *stream = put->stream;
+	uint32_t changed = 0;
+	int i;
+
+	values[SVGA_VIDEO_ENABLED]     = true;
+	values[SVGA_VIDEO_FLAGS]       = arg->flags;
+	values[SVGA_VIDEO_DATA_OFFSET] = put->buf->base.offset + arg->offset;
+	values[SVGA_VIDEO_FORMAT]      = arg->format;
+	values[SVGA_VIDEO_COLORKEY]    = arg->color_key;
+	values[SVGA_VIDEO_SIZE]        = arg->size;
+	values[SVGA_VIDEO_WIDTH]       = arg->width;
+	values[SVGA_VIDEO_HEIGHT]      = arg->height;
+	values[SVGA_VIDEO_SRC_X]       = arg->src.x;
+	values[SVGA_VIDEO_SRC_Y]       = arg->src.y;
+	values[SVGA_VIDEO_SRC_WIDTH]   = arg->src.w;
+	values[SVGA_VIDEO_SRC_HEIGHT]  = arg->src.h;
+	values[SVGA_VIDEO_DST_X]       = arg->dst.x;
+	values[SVGA_VIDEO_DST_Y]       = arg->dst.y;
+	values[SVGA_VIDEO_DST_WIDTH]   = arg->dst.w;
+	values[SVGA_VIDEO_DST_HEIGHT]  = arg->dst.h;
+	values[SVGA_VIDEO_PITCH_1]     = arg->pitch[0];
+	values[SVGA_VIDEO_PITCH_2]     = arg->pitch[1];
+	values[SVGA_VIDEO_PITCH_3]     = arg->pitch[2];
 
 	for (i = 0; i <= SVGA_VIDEO_PITCH_3; i++)
-		cmds->body.items[i].registerId = i;
-
-	offset = buf->base.offset + arg->offset;
-
-	cmds->body.items[SVGA_VIDEO_ENABLED].value     = true;
-	cmds->body.items[SVGA_VIDEO_FLAGS].value       = arg->flags;
-	cmds->body.items[SVGA_VIDEO_DATA_OFFSET].value = offset;
-	cmds->body.items[SVGA_VIDEO_FORMAT].value      = arg->format;
-	cmds->body.items[SVGA_VIDEO_COLORKEY].value    = arg->color_key;
-	cmds->body.items[SVGA_VIDEO_SIZE].value        = arg->size;
-	cmds->body.items[SVGA_VIDEO_WIDTH].value       = arg->width;
-	cmds->body.items[SVGA_VIDEO_HEIGHT].value      = arg->height;
-	cmds->body.items[SVGA_VIDEO_SRC_X].value       = arg->src.x;
-	cmds->body.items[SVGA_VIDEO_SRC_Y].value       = arg->src.y;
-	cmds->body.items[SVGA_VIDEO_SRC_WIDTH].value   = arg->src.w;
-	cmds->body.items[SVGA_VIDEO_SRC_HEIGHT].value  = arg->src.h;
-	cmds->body.items[SVGA_VIDEO_DST_X].value       = arg->dst.x;
-	cmds->body.items[SVGA_VIDEO_DST_Y].value       = arg->dst.y;
-	cmds->body.items[SVGA_VIDEO_DST_WIDTH].value   = arg->dst.w;
-	cmds->body.items[SVGA_VIDEO_DST_HEIGHT].value  = arg->dst.h;
-	cmds->body.items[SVGA_VIDEO_PITCH_1].value     = arg->pitch[0];
-	cmds->body.items[SVGA_VIDEO_PITCH_2].value     = arg->pitch[1];
-	cmds->body.items[SVGA_VIDEO_PITCH_3].value     = arg->pitch[2];
-
-	fill_flush(&cmds->flush, arg->stream_id);
+		if (!stream->regs_valid || stream->regs[i] != values[i])
+			changed |= (1 << i);
 
-	vmw_fifo_commit(dev_priv, sizeof(*cmds));
+	return changed;
+}
+
+/**
+ * Send put commands for one or more streams to hw.
+ *
+ * Only the registers that changed since the stream's last put are sent
+ * in the SET_REGS escape, and the escape is left out altogether if
+ * nothing changed. A flush is always sent, since the frame content may
+ * have been rewritten in place. All puts share a single fifo reservation
+ * and fence.
+ *
+ * Returns
+ * -ERESTARTSYS if interrupted by a signal.
+ */
+static int vmw_overlay_send_puts(struct vmw_private *dev_priv,
+				 struct vmw_overlay_put *puts,
+				 unsigned num_puts,
+				 bool interruptible)
+{
+	struct vmw_set_regs_header {
+		struct vmw_escape_header escape;
+		uint32_t cmdType;
+		uint32_t streamId;
+	} *header;
+	struct vmw_set_regs_item {
+		uint32_t registerId;
+		uint32_t value;
+	} *item;
+	uint32_t values[VMW_MAX_NUM_STREAMS][SVGA_VIDEO_PITCH_3 + 1];
+	uint32_t changed[VMW_MAX_NUM_STREAMS];
+	struct vmw_escape_video_flush *flush;
+	struct vmw_stream *stream;
+	uint32_t size = 0;
+	unsigned n, num_changed;
+	void *cmds;
+	u8 *cur;
+	int i, ret;
+
+	BUG_ON(num_puts == 0 || num_puts > VMW_MAX_NUM_STREAMS);
+
+	for (n = 0; n < num_puts; n++) {
+		stream = puts[n].stream;
+
+		/*
+		 * Keep at most one frame in flight per stream.
+		 */
+
+		if (stream->fence) {
+			ret = vmw_fence_obj_wait(stream->fence,
+						 DRM_VMW_FENCE_FLAG_EXEC,
+						 true, interruptible,
+						 VMW_FENCE_WAIT_TIMEOUT);
+			if (interruptible && ret == -ERESTARTSYS)
+				return ret;
+		}
+
+		changed[n] = vmw_overlay_put_regs(&puts[n], values[n]);
+		num_changed = hweight32(changed[n]);
+		if (num_changed)
+			size += sizeof(*header) + num_changed * sizeof(*item);
+		size += sizeof(*flush);
+	}
+
+	ret = vmw_overlay_fifo_reserve(dev_priv, puts[0].stream, size,
+				       interruptible, &cmds);
+	if (ret)
+		return ret;
+
+	cur = cmds;
+	for (n = 0; n < num_puts; n++) {
+		stream = puts[n].stream;
+		num_changed = hweight32(changed[n]);
+
+		if (num_changed) {
+			header = (struct vmw_set_regs_header *) cur;
+			fill_escape(&header->escape, sizeof(*header) -
+				    sizeof(header->escape) +
+				    num_changed * sizeof(*item));
+			header->cmdType = SVGA_ESCAPE_VMWARE_VIDEO_SET_REGS;
+			header->streamId = puts[n].arg->stream_id;
+
+			item = (struct vmw_set_regs_item *) &header[1];
+			for (i = 0; i <= SVGA_VIDEO_PITCH_3; i++) {
+				if (!(changed[n] & (1 << i)))
+					continue;
+				item->registerId = i;
+				item->value = values[n][i];
+				stream->regs[i] = values[n][i];
+				item++;
+			}
+			stream->regs_valid = true;
+			cur = (u8 *) item;
+		}
+
+		flush = (struct vmw_escape_video_flush *) cur;
+		fill_flush(flush, puts[n].arg->stream_id);
+		cur = (u8 *) &flush[1];
+	}
+
+	vmw_fifo_commit(dev_priv, size);
+
+	vmw_overlay_fence(dev_priv, puts[0].stream);
+	for (n = 1; n < num_puts; n++) {
+		stream = puts[n].stream;
+		if (stream->fence)
+			vmw_fence_obj_unreference(&stream->fence);
+		if (puts[0].stream->fence)
+			stream->fence =
+				vmw_fence_obj_reference(puts[0].stream->fence);
+	}
 
 	return 0;
 }
@@ -212,6 +456,7 @@ static int vmw_overlay_send_put(struct vmw_private *dev_priv,
  * -ERESTARTSYS if interrupted by a signal.
  */
 static int vmw_overlay_send_stop(struct vmw_private *dev_priv,
+				 struct vmw_stream *stream,
 				 uint32_t stream_id,
 				 bool interruptible)
 {
@@ -222,18 +467,10 @@ static int vmw_overlay_send_stop(struct vmw_private *dev_priv,
 	} *cmds;
 	int ret;
 
-	for (;;) {
-		cmds = vmw_fifo_reserve(dev_priv, sizeof(*cmds));
-		if (cmds)
-			break;
-
-		ret = vmw_fallback_wait(dev_priv, false, true, 0,
-					interruptible, 3*HZ);
-		if (interruptible && ret == -ERESTARTSYS)
-			return ret;
-		else
-			BUG_ON(ret != 0);
-	}
+	ret = vmw_overlay_fifo_reserve(dev_priv, stream, sizeof(*cmds),
+				       interruptible, (void **) &cmds);
+	if (ret)
+		return ret;
 
 	fill_escape(&cmds->escape, sizeof(cmds->body));
 	cmds->body.header.cmdType = SVGA_ESCAPE_VMWARE_VIDEO_SET_REGS;
@@ -243,6 +480,8 @@ static int vmw_overlay_send_stop(struct vmw_private *dev_priv,
 	fill_flush(&cmds->flush, stream_id);
 
 	vmw_fifo_commit(dev_priv, sizeof(*cmds));
+	vmw_overlay_fence(dev_priv, stream);
+	stream->regs_valid = false;
 
 	return 0;
 }
@@ -250,9 +489,9 @@ static int vmw_overlay_send_stop(struct vmw_private *dev_priv,
 /**
  * Stop or pause a stream.
  *
- * If the stream is paused the no evict flag is removed from the buffer
- * but left in vram. This allows for instance mode_set to evict it
- * should it need to.
+ * If the stream is paused the no evict flag is removed from its buffers
+ * but they are left in vram. This allows for instance mode_set to evict
+ * them should it need to.
  *
  * The caller must hold the overlay lock.
  *
@@ -265,7 +504,7 @@ static int vmw_overlay_stop(struct vmw_private *dev_priv,
 {
 	struct vmw_overlay *overlay = dev_priv->overlay_priv;
 	struct vmw_stream *stream = &overlay->stream[stream_id];
-	int ret;
+	int i, ret;
 
 	/* no buffer attached the stream is completely stopped */
 	if (!stream->buf)
@@ -273,22 +512,33 @@ static int vmw_overlay_stop(struct vmw_private *dev_priv,
 
 	/* If the stream is paused this is already done */
 	if (!stream->paused) {
-		ret = vmw_overlay_send_stop(dev_priv, stream_id,
+		ret = vmw_overlay_send_stop(dev_priv, stream, stream_id,
 					    interruptible);
 		if (ret)
 			return ret;
 
-		/* We just remove the NO_EVICT flag so no -ENOMEM */
-		ret = vmw_dmabuf_pin_in_vram(dev_priv, stream->buf, false,
-					     interruptible);
-		if (interruptible && ret == -ERESTARTSYS)
-			return ret;
-		else
-			BUG_ON(ret != 0);
+		/*
+		 * None of the frames may be unpinned before the host has
+		 * processed the stop.
+		 */
+		for (i = 0; i < VMW_STREAM_NUM_FRAMES; i++) {
+			struct vmw_stream_frame *frame = &stream->frames[i];
+
+			if (!frame->buf)
+				continue;
+			if (frame->retire_fence)
+				vmw_fence_obj_unreference(&frame->retire_fence);
+			if (stream->fence)
+				frame->retire_fence =
+					vmw_fence_obj_reference(stream->fence);
+			vmw_stream_frame_release(dev_priv, frame);
+		}
 	}
 
 	if (!pause) {
 		vmw_dmabuf_unreference(&stream->buf);
+		if (stream->fence)
+			vmw_fence_obj_unreference(&stream->fence);
 		stream->paused = false;
 	} else {
 		stream->paused = true;
@@ -297,9 +547,79 @@ static int vmw_overlay_stop(struct vmw_private *dev_priv,
 	return 0;
 }
 
+/**
+ * Make sure the buffer of a pending put is pinned in vram as one of its
+ * stream's frames.
+ *
+ * Returns
+ * -ENOMEM if buffer doesn't fit in vram.
+ * -ERESTARTSYS if interrupted.
+ */
+static int vmw_overlay_prepare_put(struct vmw_private *dev_priv,
+				   struct vmw_overlay_put *put,
+				   bool interruptible)
+{
+	int ret;
+
+	put->new_frame = false;
+	put->frame = vmw_stream_frame_find(put->stream, put->buf);
+	if (put->frame)
+		return 0;
+
+	ret = vmw_stream_frame_add(dev_priv, put->stream, put->buf,
+				   interruptible, &put->frame);
+	if (ret)
+		return ret;
+
+	put->new_frame = true;
+	return 0;
+}
+
+/**
+ * Undo vmw_overlay_prepare_put for a put that was never sent.
+ */
+static void vmw_overlay_abort_put(struct vmw_private *dev_priv,
+				  struct vmw_overlay_put *put)
+{
+	/* The host never saw it, so it can be released right away. */
+	if (put->new_frame)
+		vmw_stream_frame_release(dev_priv, put->frame);
+}
+
+/**
+ * Update stream state after a put has been sent.
+ */
+static void vmw_overlay_finish_put(struct vmw_overlay_put *put)
+{
+	struct vmw_stream *stream = put->stream;
+	struct vmw_stream_frame *old_frame;
+
+	put->frame->last_used = ++stream->num_puts;
+	if (put->frame->retire_fence)
+		vmw_fence_obj_unreference(&put->frame->retire_fence);
+
+	if (stream->buf != put->buf) {
+		old_frame = stream->buf ?
+			vmw_stream_frame_find(stream, stream->buf) : NULL;
+		if (old_frame && stream->fence)
+			old_frame->retire_fence =
+				vmw_fence_obj_reference(stream->fence);
+		if (stream->buf)
+			vmw_dmabuf_unreference(&stream->buf);
+		stream->buf = vmw_dmabuf_reference(put->buf);
+	}
+	if (&stream->saved != put->arg)
+		stream->saved = *put->arg;
+	/* stream is no longer stopped/paused */
+	stream->paused = false;
+}
+
 /**
  * Update a stream and send any put or stop fifo commands needed.
  *
+ * Buffers the stream has recently shown stay pinned in vram, so flipping
+ * between them only needs a put command.
+ *
  * The caller must hold the overlay lock.
  *
  * Returns
@@ -312,54 +632,34 @@ static int vmw_overlay_update_stream(struct vmw_private *dev_priv,
 				     bool interruptible)
 {
 	struct vmw_overlay *overlay = dev_priv->overlay_priv;
-	struct vmw_stream *stream = &overlay->stream[arg->stream_id];
-	int ret = 0;
+	struct vmw_overlay_put put;
+	int ret;
 
 	if (!buf)
 		return -EINVAL;
 
-	DRM_DEBUG("   %s: old %p, new %p, %spaused\n", __func__,
-		  stream->buf, buf, stream->paused ? "" : "not ");
-
-	if (stream->buf != buf) {
-		ret = vmw_overlay_stop(dev_priv, arg->stream_id,
-				       false, interruptible);
-		if (ret)
-			return ret;
-	} else if (!stream->paused) {
-		/* If the buffers match and not paused then just send
-		 * the put command, no need to do anything else.
-		 */
-		ret = vmw_overlay_send_put(dev_priv, buf, arg, interruptible);
-		if (ret == 0)
-			stream->saved = *arg;
-		else
-			BUG_ON(!interruptible);
+	put.stream = &overlay->stream[arg->stream_id];
+	put.buf = buf;
+	put.arg = arg;
 
-		return ret;
-	}
+	DRM_DEBUG("   %s: old %p, new %p, %spaused\n", __func__,
+		  put.stream->buf, buf, put.stream->paused ? "" : "not ");
 
 	/* We don't start the old stream if we are interrupted.
 	 * Might return -ENOMEM if it can't fit the buffer in vram.
 	 */
-	ret = vmw_dmabuf_pin_in_vram(dev_priv, buf, true, interruptible);
+	ret = vmw_overlay_prepare_put(dev_priv, &put, interruptible);
 	if (ret)
 		return ret;
 
-	ret = vmw_overlay_send_put(dev_priv, buf, arg, interruptible);
+	ret = vmw_overlay_send_puts(dev_priv, &put, 1, interruptible);
 	if (ret) {
-		/* This one needs to happen no matter what. We only remove
-		 * the NO_EVICT flag so this is safe from -ENOMEM.
-		 */
-		BUG_ON(vmw_dmabuf_pin_in_vram(dev_priv, buf, false, false) != 0);
+		BUG_ON(!interruptible);
+		vmw_overlay_abort_put(dev_priv, &put);
 		return ret;
 	}
 
-	if (stream->buf != buf)
-		stream->buf = vmw_dmabuf_reference(buf);
-	stream->saved = *arg;
-	/* stream is no longer stopped/paused */
-	stream->paused = false;
+	vmw_overlay_finish_put(&put);
 
 	return 0;
 }
@@ -405,23 +705,46 @@ int vmw_overlay_stop_all(struct vmw_private *dev_priv)
 int vmw_overlay_resume_all(struct vmw_private *dev_priv)
 {
 	struct vmw_overlay *overlay = dev_priv->overlay_priv;
-	int i, ret;
+	struct vmw_overlay_put puts[VMW_MAX_NUM_STREAMS];
+	int i, n, ret;
 
 	if (!overlay)
 		return 0;
 
 	mutex_lock(&overlay->mutex);
 
-	for (i = 0; i < VMW_MAX_NUM_STREAMS; i++) {
+	/*
+	 * Resume all streams with a single batched put.
+	 */
+
+	for (i = 0, n = 0; i < VMW_MAX_NUM_STREAMS; i++) {
 		struct vmw_stream *stream = &overlay->stream[i];
 		if (!stream->paused)
 			continue;
 
-		ret = vmw_overlay_update_stream(dev_priv, stream->buf,
-						&stream->saved, false);
-		if (ret != 0)
+		puts[n].stream = stream;
+		puts[n].buf = stream->buf;
+		puts[n].arg = &stream->saved;
+		ret = vmw_overlay_prepare_put(dev_priv, &puts[n], false);
+		if (ret != 0) {
 			DRM_INFO("%s: *warning* failed to resume stream %i\n",
 				 __func__, i);
+			continue;
+		}
+		n++;
+	}
+
+	if (n > 0) {
+		ret = vmw_overlay_send_puts(dev_priv, puts, n, false);
+		for (i = 0; i < n; i++) {
+			if (ret == 0)
+				vmw_overlay_finish_put(&puts[i]);
+			else
+				vmw_overlay_abort_put(dev_priv, &puts[i]);
+		}
+		if (ret != 0)
+			DRM_INFO("%s: *warning* failed to resume streams\n",
+				 __func__);
 	}
 
 	mutex_unlock(&overlay->mutex);
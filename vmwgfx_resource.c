@@ -30,15 +30,22 @@
 #include "ttm/ttm_object.h"
 #include "ttm/ttm_placement.h"
 #include "drmP.h"
+#include <linux/seq_file.h>
+
+extern int client_vram_quota;
+extern int client_gmr_quota;
+extern int client_mem_quota;
 
 struct vmw_user_context {
 	struct ttm_base_object base;
 	struct vmw_resource res;
+	struct vmw_client *client;
 };
 
 struct vmw_user_surface {
 	struct ttm_base_object base;
 	struct vmw_surface srf;
+	struct vmw_client *client;
 };
 
 struct vmw_user_dma_buffer {
@@ -270,6 +277,8 @@ static void vmw_user_context_free(struct vmw_resource *res)
 	struct vmw_user_context *ctx =
 	    container_of(res, struct vmw_user_context, res);
 
+	atomic_dec(&ctx->client->num_contexts);
+	vmw_client_unreference(&ctx->client);
 	kfree(ctx);
 }
 
@@ -337,6 +346,8 @@ int vmw_context_define_ioctl(struct drm_device *dev, void *data,
 	res = &ctx->res;
 	ctx->base.shareable = false;
 	ctx->base.tfile = NULL;
+	ctx->client = vmw_client_reference(vmw_fpriv(file_priv)->client);
+	atomic_inc(&ctx->client->num_contexts);
 
 	ret = vmw_context_init(dev_priv, res, vmw_user_context_free);
 	if (unlikely(ret != 0))
@@ -486,6 +497,8 @@ static void vmw_user_surface_free(struct vmw_resource *res)
 	struct vmw_user_surface *user_srf =
 	    container_of(srf, struct vmw_user_surface, srf);
 
+	atomic_dec(&user_srf->client->num_surfaces);
+	vmw_client_unreference(&user_srf->client);
 	kfree(srf->sizes);
 	kfree(srf->snooper.image);
 	kfree(user_srf);
@@ -627,6 +640,8 @@ int vmw_surface_define_ioctl(struct drm_device *dev, void *data,
 
 	user_srf->base.shareable = false;
 	user_srf->base.tfile = NULL;
+	user_srf->client = vmw_client_reference(vmw_fpriv(file_priv)->client);
+	atomic_inc(&user_srf->client->num_surfaces);
 
 	/**
 	 * From this point, the generic resource management functions
@@ -812,12 +827,240 @@ int vmw_dmabuf_init(struct vmw_private *dev_priv,
 static void vmw_user_dmabuf_destroy(struct ttm_buffer_object *bo)
 {
 	struct vmw_user_dma_buffer *vmw_user_bo = vmw_user_dma_buffer(bo);
+	struct vmw_client *client = vmw_user_bo->dma.client;
 	struct ttm_bo_global *glob = bo->glob;
 
+	if (client != NULL) {
+		atomic_dec(&client->num_dmabufs);
+		atomic_long_sub(bo->num_pages, &client->dmabuf_pages);
+		vmw_client_unreference(&vmw_user_bo->dma.client);
+	}
+
 	ttm_mem_global_free(glob->mem_glob, bo->acc_size);
 	kfree(vmw_user_bo);
 }
 
+/**
+ * vmw_client_account_pages - Add to a client's placement counters.
+ *
+ * @client: The client.
+ * @mem_type: The TTM memory type the pages are placed in.
+ * @pages: Number of pages to add. May be negative.
+ */
+static void vmw_client_account_pages(struct vmw_client *client,
+				     uint32_t mem_type, long pages)
+{
+	switch (mem_type) {
+	case TTM_PL_VRAM:
+		atomic_long_add(pages, &client->vram_pages);
+		break;
+	case VMW_PL_GMR:
+		atomic_long_add(pages, &client->gmr_pages);
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * vmw_dmabuf_move_notify - TTM move_notify callback.
+ *
+ * @bo: The buffer object about to move. Reserved by the caller.
+ * @mem: The new placement, or NULL if the bo's memory is released.
+ *
+ * Moves the pages of a client-owned buffer between the client's VRAM
+ * and GMR counters.
+ */
+void vmw_dmabuf_move_notify(struct ttm_buffer_object *bo,
+			    struct ttm_mem_reg *mem)
+{
+	struct vmw_dma_buffer *vmw_bo = vmw_dma_buffer(bo);
+	uint32_t mem_type = (mem != NULL) ? mem->mem_type : TTM_PL_SYSTEM;
+
+	if (vmw_bo->client != NULL && mem_type != vmw_bo->acct_mem_type) {
+		vmw_client_account_pages(vmw_bo->client, vmw_bo->acct_mem_type,
+					 -(long) bo->num_pages);
+		vmw_client_account_pages(vmw_bo->client, mem_type,
+					 bo->num_pages);
+	}
+
+	vmw_bo->acct_mem_type = mem_type;
+}
+
+/**
+ * vmw_client_quota_pages - Page limit of a client for a memory type.
+ *
+ * @mem_type: A TTM memory type.
+ *
+ * Returns 0 if the memory type has no quota.
+ */
+static unsigned long vmw_client_quota_pages(uint32_t mem_type)
+{
+	switch (mem_type) {
+	case TTM_PL_VRAM:
+		return (unsigned long) max(client_vram_quota, 0) <<
+			(20 - PAGE_SHIFT);
+	case VMW_PL_GMR:
+		return (unsigned long) max(client_gmr_quota, 0);
+	default:
+		return 0;
+	}
+}
+
+static long vmw_client_used_pages(struct vmw_client *client,
+				  uint32_t mem_type)
+{
+	switch (mem_type) {
+	case TTM_PL_VRAM:
+		return atomic_long_read(&client->vram_pages);
+	case VMW_PL_GMR:
+		return atomic_long_read(&client->gmr_pages);
+	default:
+		return 0;
+	}
+}
+
+/**
+ * vmw_client_mem_quota_exceeded - Check the limit on total buffer size.
+ *
+ * @client: The client.
+ * @pages: Number of pages the client wants to allocate.
+ * @inclusive: Also return true if the client would end up exactly at
+ * its limit.
+ */
+static bool vmw_client_mem_quota_exceeded(struct vmw_client *client,
+					  unsigned long pages, bool inclusive)
+{
+	unsigned long limit = (unsigned long) max(client_mem_quota, 0) <<
+		(20 - PAGE_SHIFT);
+	unsigned long used = atomic_long_read(&client->dmabuf_pages) + pages;
+
+	if (limit == 0)
+		return false;
+
+	return (inclusive) ? used >= limit : used > limit;
+}
+
+/**
+ * vmw_dmabuf_quota_exceeded - TTM quota_exceeded callback.
+ *
+ * @bo: The buffer object about to be placed.
+ * @mem_type: The memory type it is about to be placed in.
+ *
+ * Returns true if the bo's client would go over its VRAM or GMR quota.
+ * Buffers that already live in @mem_type are charged already.
+ */
+bool vmw_dmabuf_quota_exceeded(struct ttm_buffer_object *bo,
+			       uint32_t mem_type)
+{
+	struct vmw_client *client = vmw_dma_buffer(bo)->client;
+	unsigned long limit = vmw_client_quota_pages(mem_type);
+
+	if (client == NULL || limit == 0 || bo->mem.mem_type == mem_type)
+		return false;
+
+	return vmw_client_used_pages(client, mem_type) + bo->num_pages > limit;
+}
+
+/**
+ * vmw_client_over_quota - Check whether a client has used up a quota.
+ *
+ * @client: The client.
+ * @mem_type: A TTM memory type.
+ *
+ * Returns true if the client is at or above its total buffer quota or
+ * its quota for @mem_type.
+ */
+static bool vmw_client_over_quota(struct vmw_client *client,
+				  uint32_t mem_type)
+{
+	unsigned long limit;
+
+	if (vmw_client_mem_quota_exceeded(client, 0, true))
+		return true;
+
+	limit = vmw_client_quota_pages(mem_type);
+	return limit != 0 &&
+		vmw_client_used_pages(client, mem_type) >= limit;
+}
+
+/**
+ * vmw_dmabuf_evict_prefer - TTM evict_prefer callback.
+ *
+ * @bo: A buffer object on an LRU list.
+ *
+ * Buffers of clients that have used up their quota for the bo's
+ * current memory type, or their total buffer quota, are evicted first,
+ * so that a single client can't push out everybody else's working set.
+ */
+bool vmw_dmabuf_evict_prefer(struct ttm_buffer_object *bo)
+{
+	struct vmw_client *client = vmw_dma_buffer(bo)->client;
+
+	if (client == NULL)
+		return false;
+
+	return vmw_client_over_quota(client, bo->mem.mem_type);
+}
+
+/**
+ * vmw_dmabuf_evict_prefer_active - TTM evict_prefer_active callback.
+ *
+ * @bdev: The TTM device.
+ * @mem_type: The memory type about to be evicted from.
+ *
+ * Returns true only if some client is over quota for @mem_type, so
+ * that the LRU list isn't walked when there is nothing to prefer,
+ * and in particular when no quota is configured.
+ */
+bool vmw_dmabuf_evict_prefer_active(struct ttm_bo_device *bdev,
+				    uint32_t mem_type)
+{
+	struct vmw_private *dev_priv =
+		container_of(bdev, struct vmw_private, bdev);
+	struct vmw_client *client;
+	bool ret = false;
+
+	if (client_mem_quota <= 0 && vmw_client_quota_pages(mem_type) == 0)
+		return false;
+
+	spin_lock(&dev_priv->client_lock);
+	list_for_each_entry(client, &dev_priv->client_list, head) {
+		if (vmw_client_over_quota(client, mem_type)) {
+			ret = true;
+			break;
+		}
+	}
+	spin_unlock(&dev_priv->client_lock);
+
+	return ret;
+}
+
+/**
+ * vmw_dmabuf_set_client - Charge a buffer object to a client.
+ *
+ * @vmw_bo: The buffer object. Must not yet be charged to a client.
+ * @client: The client.
+ *
+ * The bo is reserved so that its placement can't change while the
+ * client's counters are brought up to date.
+ */
+static void vmw_dmabuf_set_client(struct vmw_dma_buffer *vmw_bo,
+				  struct vmw_client *client)
+{
+	struct ttm_buffer_object *bo = &vmw_bo->base;
+
+	BUG_ON(vmw_bo->client != NULL);
+
+	(void) ttm_bo_reserve(bo, false, false, false, 0);
+	vmw_bo->client = vmw_client_reference(client);
+	atomic_inc(&client->num_dmabufs);
+	atomic_long_add(bo->num_pages, &client->dmabuf_pages);
+	vmw_client_account_pages(client, vmw_bo->acct_mem_type,
+				 bo->num_pages);
+	ttm_bo_unreserve(bo);
+}
+
 static void vmw_user_dmabuf_release(struct ttm_base_object **p_base)
 {
 	struct vmw_user_dma_buffer *vmw_user_bo;
@@ -847,6 +1090,11 @@ int vmw_dmabuf_alloc_ioctl(struct drm_device *dev, void *data,
 	struct vmw_master *vmaster = vmw_master(file_priv->master);
 	int ret;
 
+	if (unlikely(vmw_client_mem_quota_exceeded
+		     (vmw_fpriv(file_priv)->client,
+		      (req->size + PAGE_SIZE - 1) >> PAGE_SHIFT, false)))
+		return -ENOMEM;
+
 	vmw_user_bo = kzalloc(sizeof(*vmw_user_bo), GFP_KERNEL);
 	if (unlikely(vmw_user_bo == NULL))
 		return -ENOMEM;
@@ -863,6 +1111,8 @@ int vmw_dmabuf_alloc_ioctl(struct drm_device *dev, void *data,
 	if (unlikely(ret != 0))
 		goto out_no_dmabuf;
 
+	vmw_dmabuf_set_client(&vmw_user_bo->dma, vmw_fpriv(file_priv)->client);
+
 	tmp = ttm_bo_reference(&vmw_user_bo->dma.base);
 	ret = ttm_base_object_init(vmw_fpriv(file_priv)->tfile,
 				   &vmw_user_bo->base,
@@ -1119,3 +1369,102 @@ err_ref:
 	vmw_resource_unreference(&res);
 	return ret;
 }
+
+/**
+ * Client accounting.
+ */
+
+/**
+ * vmw_client_alloc - Allocate accounting for a new drm file.
+ *
+ * @dev_priv: Pointer to the device private struct.
+ *
+ * The client is charged to the current process and is added to the
+ * device's client list. Returns NULL on allocation failure.
+ */
+struct vmw_client *vmw_client_alloc(struct vmw_private *dev_priv)
+{
+	struct vmw_client *client = kzalloc(sizeof(*client), GFP_KERNEL);
+
+	if (unlikely(client == NULL))
+		return NULL;
+
+	kref_init(&client->kref);
+	client->dev_priv = dev_priv;
+	client->pid = task_pid_nr(current);
+	get_task_comm(client->comm, current);
+
+	spin_lock(&dev_priv->client_lock);
+	list_add_tail(&client->head, &dev_priv->client_list);
+	spin_unlock(&dev_priv->client_lock);
+
+	return client;
+}
+
+struct vmw_client *vmw_client_reference(struct vmw_client *client)
+{
+	kref_get(&client->kref);
+	return client;
+}
+
+static void vmw_client_release(struct kref *kref)
+{
+	struct vmw_client *client =
+	    container_of(kref, struct vmw_client, kref);
+	struct vmw_private *dev_priv = client->dev_priv;
+
+	spin_lock(&dev_priv->client_lock);
+	list_del(&client->head);
+	spin_unlock(&dev_priv->client_lock);
+	kfree(client);
+}
+
+void vmw_client_unreference(struct vmw_client **p_client)
+{
+	struct vmw_client *client = *p_client;
+
+	*p_client = NULL;
+	kref_put(&client->kref, vmw_client_release);
+}
+
+#if defined(CONFIG_DEBUG_FS)
+/**
+ * vmw_client_debugfs - Show per-client resource usage.
+ *
+ * Clients whose file is closed are listed for as long as objects they
+ * created are still alive.
+ */
+int vmw_client_debugfs(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = (struct drm_info_node *) m->private;
+	struct vmw_private *dev_priv = vmw_priv(node->minor->dev);
+	struct vmw_client *client;
+
+	if (dev_priv == NULL) {
+		seq_printf(m, "driver not loaded\n");
+		return 0;
+	}
+
+	seq_printf(m, "%8s %-16s %8s %8s %8s %10s %10s %10s\n",
+		   "pid", "command", "contexts", "surfaces", "dmabufs",
+		   "dmabuf kB", "vram kB", "gmr kB");
+
+	spin_lock(&dev_priv->client_lock);
+	list_for_each_entry(client, &dev_priv->client_list, head) {
+		seq_printf(m, "%8d %-16s %8d %8d %8d %10lu %10lu %10lu\n",
+			   client->pid, client->comm,
+			   atomic_read(&client->num_contexts),
+			   atomic_read(&client->num_surfaces),
+			   atomic_read(&client->num_dmabufs),
+			   atomic_long_read(&client->dmabuf_pages) <<
+			   (PAGE_SHIFT - 10),
+			   atomic_long_read(&client->vram_pages) <<
+			   (PAGE_SHIFT - 10),
+			   atomic_long_read(&client->gmr_pages) <<
+			   (PAGE_SHIFT - 10));
+	}
+	spin_unlock(&dev_priv->client_lock);
+
+	return 0;
+}
+#endif
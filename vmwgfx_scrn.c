@@ -0,0 +1,572 @@
+/**************************************************************************
+ *
+ * Copyright © 2011 VMware, Inc., Palo Alto, CA., USA
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#include "vmwgfx_kms.h"
+
+#define VMWGFX_SOU_NUM_DU 8
+
+#define vmw_crtc_to_sou(x) \
+	container_of(x, struct vmw_screen_object_unit, base.crtc)
+#define vmw_encoder_to_sou(x) \
+	container_of(x, struct vmw_screen_object_unit, base.encoder)
+#define vmw_connector_to_sou(x) \
+	container_of(x, struct vmw_screen_object_unit, base.connector)
+
+struct vmw_screen_object_display {
+	struct list_head active;
+
+	unsigned num_active;
+};
+
+/**
+ * Display unit using screen objects.
+ *
+ * Each unit scans out its own framebuffer, which is blitted to the
+ * screen from wherever its buffer currently lives.
+ */
+struct vmw_screen_object_unit {
+	struct vmw_display_unit base;
+
+	struct vmw_framebuffer *fb;
+	bool defined;
+
+	struct list_head active;
+};
+
+static void vmw_sou_destroy(struct vmw_screen_object_unit *sou)
+{
+	list_del_init(&sou->active);
+	vmw_display_unit_cleanup(&sou->base);
+	kfree(sou);
+}
+
+
+/*
+ * Screen Object Display Unit CRTC functions
+ */
+
+static void vmw_sou_crtc_save(struct drm_crtc *crtc)
+{
+}
+
+static void vmw_sou_crtc_restore(struct drm_crtc *crtc)
+{
+}
+
+static void vmw_sou_crtc_gamma_set(struct drm_crtc *crtc,
+				   u16 *r, u16 *g, u16 *b,
+				   uint32_t size)
+{
+	/* Screen objects are always true-color. */
+}
+
+static void vmw_sou_crtc_destroy(struct drm_crtc *crtc)
+{
+	vmw_sou_destroy(vmw_crtc_to_sou(crtc));
+}
+
+/**
+ * Send the fifo command to create a screen.
+ */
+static int vmw_sou_fifo_create(struct vmw_private *dev_priv,
+			       struct vmw_screen_object_unit *sou,
+			       int x, int y,
+			       struct drm_display_mode *mode)
+{
+	size_t fifo_size;
+
+	struct {
+		uint32_t header;
+		SVGAScreenObject obj;
+	} *cmd;
+
+	fifo_size = sizeof(*cmd);
+	cmd = vmw_fifo_reserve(dev_priv, fifo_size);
+	if (unlikely(cmd == NULL)) {
+		DRM_ERROR("Fifo reserve failed.\n");
+		return -ENOMEM;
+	}
+
+	memset(cmd, 0, fifo_size);
+	cmd->header = SVGA_CMD_DEFINE_SCREEN;
+	cmd->obj.structSize = sizeof(SVGAScreenObject);
+	cmd->obj.id = sou->base.unit;
+	cmd->obj.flags = SVGA_SCREEN_HAS_ROOT |
+		(sou->base.unit == 0 ? SVGA_SCREEN_IS_PRIMARY : 0);
+	cmd->obj.size.width = mode->hdisplay;
+	cmd->obj.size.height = mode->vdisplay;
+	cmd->obj.root.x = x;
+	cmd->obj.root.y = y;
+
+	vmw_fifo_commit(dev_priv, fifo_size);
+
+	sou->defined = true;
+
+	return 0;
+}
+
+/**
+ * Send the fifo command to destroy a screen.
+ */
+static int vmw_sou_fifo_destroy(struct vmw_private *dev_priv,
+				struct vmw_screen_object_unit *sou)
+{
+	size_t fifo_size;
+
+	struct {
+		uint32_t header;
+		SVGAFifoCmdDestroyScreen body;
+	} *cmd;
+
+	/* no need to do anything */
+	if (unlikely(!sou->defined))
+		return 0;
+
+	fifo_size = sizeof(*cmd);
+	cmd = vmw_fifo_reserve(dev_priv, fifo_size);
+	if (unlikely(cmd == NULL)) {
+		DRM_ERROR("Fifo reserve failed.\n");
+		return -ENOMEM;
+	}
+
+	memset(cmd, 0, fifo_size);
+	cmd->header = SVGA_CMD_DESTROY_SCREEN;
+	cmd->body.screenId = sou->base.unit;
+
+	vmw_fifo_commit(dev_priv, fifo_size);
+
+	sou->defined = false;
+
+	return 0;
+}
+
+static void vmw_sou_del_active(struct vmw_private *vmw_priv,
+			       struct vmw_screen_object_unit *sou)
+{
+	struct vmw_screen_object_display *ld = vmw_priv->sou_priv;
+
+	if (list_empty(&sou->active))
+		return;
+
+	/* Must init otherwise list_empty(&sou->active) will not work. */
+	list_del_init(&sou->active);
+	if (sou->fb && sou->fb->unpin)
+		sou->fb->unpin(sou->fb);
+	sou->fb = NULL;
+	ld->num_active--;
+}
+
+static void vmw_sou_add_active(struct vmw_private *vmw_priv,
+			       struct vmw_screen_object_unit *sou,
+			       struct vmw_framebuffer *vfb)
+{
+	struct vmw_screen_object_display *ld = vmw_priv->sou_priv;
+	struct vmw_screen_object_unit *entry;
+	struct list_head *at;
+
+	if (vfb != sou->fb) {
+		if (sou->fb && sou->fb->unpin)
+			sou->fb->unpin(sou->fb);
+		if (vfb->pin)
+			vfb->pin(vfb);
+		sou->fb = vfb;
+	}
+
+	if (!list_empty(&sou->active))
+		return;
+
+	at = &ld->active;
+	list_for_each_entry(entry, &ld->active, active) {
+		if (entry->base.unit > sou->base.unit)
+			break;
+
+		at = &entry->active;
+	}
+
+	list_add(&sou->active, at);
+
+	ld->num_active++;
+}
+
+static int vmw_sou_crtc_set_config(struct drm_mode_set *set)
+{
+	struct vmw_private *dev_priv;
+	struct vmw_screen_object_unit *sou;
+	struct drm_connector *connector;
+	struct drm_display_mode *mode;
+	struct drm_encoder *encoder;
+	struct vmw_framebuffer *vfb;
+	struct drm_framebuffer *fb;
+	struct drm_clip_rect clip;
+	struct drm_crtc *crtc;
+	int ret;
+
+	if (!set)
+		return -EINVAL;
+
+	if (!set->crtc)
+		return -EINVAL;
+
+	/* get the sou */
+	crtc = set->crtc;
+	sou = vmw_crtc_to_sou(crtc);
+	vfb = set->fb ? vmw_framebuffer_to_vfb(set->fb) : NULL;
+	dev_priv = vmw_priv(crtc->dev);
+
+	if (set->num_connectors > 1) {
+		DRM_ERROR("to many connectors\n");
+		return -EINVAL;
+	}
+
+	if (set->num_connectors == 1 &&
+	    set->connectors[0] != &sou->base.connector) {
+		DRM_ERROR("connector doesn't match %p %p\n",
+			set->connectors[0], &sou->base.connector);
+		return -EINVAL;
+	}
+
+	/* since they always map one to one these are safe */
+	connector = &sou->base.connector;
+	encoder = &sou->base.encoder;
+
+	/* should we turn the crtc off? */
+	if (set->num_connectors == 0 || !set->mode || !set->fb) {
+
+		connector->encoder = NULL;
+		encoder->crtc = NULL;
+		crtc->fb = NULL;
+
+		vmw_sou_del_active(dev_priv, sou);
+		vmw_du_vblank_mode_set(&sou->base, NULL);
+
+		return vmw_sou_fifo_destroy(dev_priv, sou);
+	}
+
+
+	/* we now know we want to set a mode */
+	mode = set->mode;
+	fb = set->fb;
+
+	if (set->x + mode->hdisplay > fb->width ||
+	    set->y + mode->vdisplay > fb->height) {
+		DRM_ERROR("set outside of framebuffer\n");
+		return -EINVAL;
+	}
+
+	vmw_fb_off(dev_priv);
+
+	/*
+	 * The screen keeps its contents across a redefine, so there is no
+	 * need to destroy it first when only the size or position changes.
+	 */
+	ret = vmw_sou_fifo_create(dev_priv, sou, set->x, set->y, mode);
+	if (unlikely(ret != 0))
+		return ret;
+
+	crtc->fb = fb;
+	encoder->crtc = crtc;
+	connector->encoder = encoder;
+	crtc->x = set->x;
+	crtc->y = set->y;
+	crtc->mode = *mode;
+
+	vmw_sou_add_active(dev_priv, sou, vfb);
+	vmw_du_vblank_mode_set(&sou->base, &crtc->mode);
+
+	/* Fill the new screen with the visible part of the framebuffer. */
+	clip.x1 = crtc->x;
+	clip.y1 = crtc->y;
+	clip.x2 = crtc->x + mode->hdisplay;
+	clip.y2 = crtc->y + mode->vdisplay;
+
+	return vmw_kms_sou_update_fb(dev_priv, vfb, &clip, 1, NULL);
+}
+
+/**
+ * vmw_sou_send_event - Deliver a flip completion event right away.
+ *
+ * Used when the event can't be tied to a fence. The flip has then
+ * already been emitted, so the client is told about it immediately
+ * rather than never.
+ */
+static void vmw_sou_send_event(struct drm_device *dev,
+			       struct drm_pending_vblank_event *event)
+{
+	struct drm_file *file_priv = event->base.file_priv;
+	unsigned long irq_flags;
+	struct timeval tv;
+
+	do_gettimeofday(&tv);
+	event->event.tv_sec = tv.tv_sec;
+	event->event.tv_usec = tv.tv_usec;
+	event->event.sequence = drm_vblank_count(dev, event->pipe);
+
+	spin_lock_irqsave(&dev->event_lock, irq_flags);
+	list_add_tail(&event->base.link, &file_priv->event_list);
+	wake_up_all(&file_priv->event_wait);
+	spin_unlock_irqrestore(&dev->event_lock, irq_flags);
+}
+
+/**
+ * vmw_sou_crtc_page_flip - Flip a screen to a new framebuffer.
+ *
+ * Blits the visible part of @fb to the screen and, if an event was
+ * requested, queues it on the fence following the blit so that it is
+ * delivered once the device is done reading from the framebuffer.
+ * Once the blit has been emitted the flip can't be undone, so the
+ * event is then delivered immediately if it can't be queued.
+ */
+static int vmw_sou_crtc_page_flip(struct drm_crtc *crtc,
+				  struct drm_framebuffer *fb,
+				  struct drm_pending_vblank_event *event)
+{
+	struct vmw_private *dev_priv = vmw_priv(crtc->dev);
+	struct vmw_screen_object_unit *sou = vmw_crtc_to_sou(crtc);
+	struct vmw_framebuffer *vfb = vmw_framebuffer_to_vfb(fb);
+	struct drm_framebuffer *old_fb = crtc->fb;
+	struct vmw_fence_obj *fence = NULL;
+	struct drm_clip_rect clip;
+	int ret;
+
+	if (list_empty(&sou->active))
+		return -EINVAL;
+
+	ret = ttm_read_lock(&dev_priv->active_master->lock, true);
+	if (unlikely(ret != 0))
+		return ret;
+
+	crtc->fb = fb;
+
+	clip.x1 = crtc->x;
+	clip.y1 = crtc->y;
+	clip.x2 = crtc->x + crtc->mode.hdisplay;
+	clip.y2 = crtc->y + crtc->mode.vdisplay;
+
+	ret = vmw_kms_sou_update_fb(dev_priv, vfb, &clip, 1, &fence);
+	if (unlikely(ret != 0)) {
+		crtc->fb = old_fb;
+		goto out_unlock;
+	}
+
+	sou->fb = vfb;
+
+	if (event) {
+		event->pipe = sou->base.unit;
+		ret = -EINVAL;
+		if (likely(fence != NULL))
+			ret = vmw_event_fence_action_queue(event->base.file_priv,
+							   fence,
+							   &event->base,
+							   &event->event.tv_sec,
+							   &event->event.tv_usec,
+							   &event->event.sequence,
+							   sou->base.unit);
+		if (unlikely(ret != 0))
+			vmw_sou_send_event(crtc->dev, event);
+		ret = 0;
+	}
+
+	if (fence)
+		vmw_fence_obj_unreference(&fence);
+
+out_unlock:
+	ttm_read_unlock(&dev_priv->active_master->lock);
+
+	return ret;
+}
+
+static struct drm_crtc_funcs vmw_screen_object_crtc_funcs = {
+	.save = vmw_sou_crtc_save,
+	.restore = vmw_sou_crtc_restore,
+	.cursor_set = vmw_du_crtc_cursor_set,
+	.cursor_move = vmw_du_crtc_cursor_move,
+	.gamma_set = vmw_sou_crtc_gamma_set,
+	.destroy = vmw_sou_crtc_destroy,
+	.set_config = vmw_sou_crtc_set_config,
+	.page_flip = vmw_sou_crtc_page_flip,
+};
+
+/*
+ * Screen Object Display Unit encoder functions
+ */
+
+static void vmw_sou_encoder_destroy(struct drm_encoder *encoder)
+{
+	vmw_sou_destroy(vmw_encoder_to_sou(encoder));
+}
+
+static struct drm_encoder_funcs vmw_screen_object_encoder_funcs = {
+	.destroy = vmw_sou_encoder_destroy,
+};
+
+/*
+ * Screen Object Display Unit connector functions
+ */
+
+static void vmw_sou_connector_dpms(struct drm_connector *connector, int mode)
+{
+}
+
+static void vmw_sou_connector_save(struct drm_connector *connector)
+{
+}
+
+static void vmw_sou_connector_restore(struct drm_connector *connector)
+{
+}
+
+static int vmw_sou_connector_set_property(struct drm_connector *connector,
+					  struct drm_property *property,
+					  uint64_t val)
+{
+	return 0;
+}
+
+static void vmw_sou_connector_destroy(struct drm_connector *connector)
+{
+	vmw_sou_destroy(vmw_connector_to_sou(connector));
+}
+
+static struct drm_connector_funcs vmw_screen_object_connector_funcs = {
+	.dpms = vmw_sou_connector_dpms,
+	.save = vmw_sou_connector_save,
+	.restore = vmw_sou_connector_restore,
+	.detect = vmw_du_connector_detect,
+	.fill_modes = vmw_du_connector_fill_modes,
+	.set_property = vmw_sou_connector_set_property,
+	.destroy = vmw_sou_connector_destroy,
+};
+
+static int vmw_sou_init(struct vmw_private *dev_priv, unsigned unit)
+{
+	struct vmw_screen_object_unit *sou;
+	struct drm_device *dev = dev_priv->dev;
+	struct drm_connector *connector;
+	struct drm_encoder *encoder;
+	struct drm_crtc *crtc;
+
+	sou = kzalloc(sizeof(*sou), GFP_KERNEL);
+	if (!sou)
+		return -ENOMEM;
+
+	sou->base.unit = unit;
+	crtc = &sou->base.crtc;
+	encoder = &sou->base.encoder;
+	connector = &sou->base.connector;
+
+	INIT_LIST_HEAD(&sou->active);
+
+	sou->base.pref_active = (unit == 0);
+	sou->base.pref_width = 800;
+	sou->base.pref_height = 600;
+	sou->base.pref_mode = NULL;
+	sou->base.modes_valid = false;
+
+	drm_connector_init(dev, connector, &vmw_screen_object_connector_funcs,
+			   DRM_MODE_CONNECTOR_LVDS);
+	connector->status = vmw_du_connector_detect(connector);
+
+	drm_encoder_init(dev, encoder, &vmw_screen_object_encoder_funcs,
+			 DRM_MODE_ENCODER_LVDS);
+	drm_mode_connector_attach_encoder(connector, encoder);
+	encoder->possible_crtcs = (1 << unit);
+	encoder->possible_clones = 0;
+
+	vmw_du_vblank_init(&sou->base);
+	drm_crtc_init(dev, crtc, &vmw_screen_object_crtc_funcs);
+
+	drm_mode_crtc_set_gamma_size(crtc, 256);
+
+	drm_connector_attach_property(connector,
+				      dev->mode_config.dirty_info_property,
+				      1);
+
+	return 0;
+}
+
+int vmw_kms_init_screen_object_display(struct vmw_private *dev_priv)
+{
+	struct drm_device *dev = dev_priv->dev;
+	int i, ret;
+
+	if (dev_priv->sou_priv) {
+		DRM_INFO("sou system already on\n");
+		return -EINVAL;
+	}
+
+	if (!vmw_fifo_have_screen_object(dev_priv)) {
+		DRM_INFO("Not using screen objects,"
+			 " missing cap SCREEN_OBJECT\n");
+		return -ENOSYS;
+	}
+
+	ret = -ENOMEM;
+	dev_priv->sou_priv = kmalloc(sizeof(*dev_priv->sou_priv), GFP_KERNEL);
+	if (unlikely(!dev_priv->sou_priv))
+		goto err_no_mem;
+
+	INIT_LIST_HEAD(&dev_priv->sou_priv->active);
+	dev_priv->sou_priv->num_active = 0;
+
+	ret = drm_vblank_init(dev, VMWGFX_SOU_NUM_DU);
+	if (unlikely(ret != 0))
+		goto err_free;
+
+	/* Let idle crtcs stop their vblank timers. */
+	dev->vblank_disable_allowed = 1;
+
+	drm_mode_create_dirty_info_property(dev_priv->dev);
+
+	for (i = 0; i < VMWGFX_SOU_NUM_DU; ++i)
+		vmw_sou_init(dev_priv, i);
+
+	DRM_INFO("Screen objects system initialized\n");
+
+	return 0;
+
+err_free:
+	kfree(dev_priv->sou_priv);
+	dev_priv->sou_priv = NULL;
+err_no_mem:
+	return ret;
+}
+
+int vmw_kms_close_screen_object_display(struct vmw_private *dev_priv)
+{
+	struct drm_device *dev = dev_priv->dev;
+
+	drm_vblank_cleanup(dev);
+	if (!dev_priv->sou_priv)
+		return -ENOSYS;
+
+	BUG_ON(!list_empty(&dev_priv->sou_priv->active));
+
+	kfree(dev_priv->sou_priv);
+	dev_priv->sou_priv = NULL;
+
+	return 0;
+}
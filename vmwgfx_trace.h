@@ -0,0 +1,243 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2011 VMware, Inc., Palo Alto, CA., USA
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#if !defined(_VMWGFX_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _VMWGFX_TRACE_H_
+
+/*
+ * Tracepoints along the command submission pipeline, from execbuf
+ * through fifo reservation and fence emission to fence retirement.
+ * Events are timestamped by the tracer. Events emitted in the
+ * submitting client's context carry its pid as the tracer's common
+ * pid. Fence retirement runs in interrupt context, so the submitter's
+ * pid is recorded in the fence and emitted explicitly. vmw_irq is not
+ * attributed to any client.
+ */
+
+#ifdef VMW_HAS_TRACE_EVENTS
+
+#include <linux/tracepoint.h>
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM vmwgfx
+#define TRACE_INCLUDE_FILE vmwgfx_trace
+
+#define show_vmw_wait_reason(reason)					\
+	__print_symbolic(reason,					\
+			 { VMW_WAIT_FIFO_SPACE, "fifo_space" },		\
+			 { VMW_WAIT_SEQNO, "seqno" },			\
+			 { VMW_WAIT_SEQNO_POLL, "seqno_poll" },		\
+			 { VMW_WAIT_FIFO_IDLE, "fifo_idle" },		\
+			 { VMW_WAIT_LAG, "lag" })
+
+TRACE_EVENT(vmw_execbuf,
+	TP_PROTO(uint32_t cid, uint32_t bytes, uint32_t num_buffers,
+		 uint32_t seqno),
+	TP_ARGS(cid, bytes, num_buffers, seqno),
+
+	TP_STRUCT__entry(
+		__field(uint32_t, cid)
+		__field(uint32_t, bytes)
+		__field(uint32_t, num_buffers)
+		__field(uint32_t, seqno)
+	),
+
+	TP_fast_assign(
+		__entry->cid = cid;
+		__entry->bytes = bytes;
+		__entry->num_buffers = num_buffers;
+		__entry->seqno = seqno;
+	),
+
+	TP_printk("cid=%u bytes=%u buffers=%u seqno=%u",
+		  __entry->cid, __entry->bytes, __entry->num_buffers,
+		  __entry->seqno)
+);
+
+TRACE_EVENT(vmw_fifo_reserve,
+	TP_PROTO(uint32_t bytes, uint32_t next_cmd, uint32_t stop,
+		 uint32_t min, uint32_t max, bool bounce),
+	TP_ARGS(bytes, next_cmd, stop, min, max, bounce),
+
+	TP_STRUCT__entry(
+		__field(uint32_t, bytes)
+		__field(uint32_t, free)
+		__field(bool, bounce)
+	),
+
+	TP_fast_assign(
+		__entry->bytes = bytes;
+		__entry->free = (next_cmd >= stop) ?
+			(max - next_cmd) + (stop - min) : stop - next_cmd;
+		__entry->bounce = bounce;
+	),
+
+	TP_printk("bytes=%u free=%u bounce=%d",
+		  __entry->bytes, __entry->free, __entry->bounce)
+);
+
+TRACE_EVENT(vmw_fifo_commit,
+	TP_PROTO(uint32_t bytes, bool bounce),
+	TP_ARGS(bytes, bounce),
+
+	TP_STRUCT__entry(
+		__field(uint32_t, bytes)
+		__field(bool, bounce)
+	),
+
+	TP_fast_assign(
+		__entry->bytes = bytes;
+		__entry->bounce = bounce;
+	),
+
+	TP_printk("bytes=%u bounce=%d", __entry->bytes, __entry->bounce)
+);
+
+TRACE_EVENT(vmw_fence_send,
+	TP_PROTO(uint32_t seqno, bool emulated),
+	TP_ARGS(seqno, emulated),
+
+	TP_STRUCT__entry(
+		__field(uint32_t, seqno)
+		__field(bool, emulated)
+	),
+
+	TP_fast_assign(
+		__entry->seqno = seqno;
+		__entry->emulated = emulated;
+	),
+
+	TP_printk("seqno=%u emulated=%d", __entry->seqno, __entry->emulated)
+);
+
+TRACE_EVENT(vmw_fence_signaled,
+	TP_PROTO(uint32_t seqno, pid_t pid, u64 latency_ns),
+	TP_ARGS(seqno, pid, latency_ns),
+
+	TP_STRUCT__entry(
+		__field(uint32_t, seqno)
+		__field(pid_t, pid)
+		__field(u64, latency_ns)
+	),
+
+	TP_fast_assign(
+		__entry->seqno = seqno;
+		__entry->pid = pid;
+		__entry->latency_ns = latency_ns;
+	),
+
+	TP_printk("seqno=%u pid=%d latency_ns=%llu", __entry->seqno,
+		  __entry->pid, (unsigned long long) __entry->latency_ns)
+);
+
+TRACE_EVENT(vmw_irq,
+	TP_PROTO(uint32_t status, uint32_t seqno),
+	TP_ARGS(status, seqno),
+
+	TP_STRUCT__entry(
+		__field(uint32_t, status)
+		__field(uint32_t, seqno)
+	),
+
+	TP_fast_assign(
+		__entry->status = status;
+		__entry->seqno = seqno;
+	),
+
+	TP_printk("status=0x%08x seqno=%u", __entry->status, __entry->seqno)
+);
+
+TRACE_EVENT(vmw_wait,
+	TP_PROTO(enum vmw_wait_reason reason, uint32_t value, int ret,
+		 u64 duration_ns),
+	TP_ARGS(reason, value, ret, duration_ns),
+
+	TP_STRUCT__entry(
+		__field(int, reason)
+		__field(uint32_t, value)
+		__field(int, ret)
+		__field(u64, duration_ns)
+	),
+
+	TP_fast_assign(
+		__entry->reason = reason;
+		__entry->value = value;
+		__entry->ret = ret;
+		__entry->duration_ns = duration_ns;
+	),
+
+	TP_printk("reason=%s value=%u ret=%d duration_ns=%llu",
+		  show_vmw_wait_reason(__entry->reason), __entry->value,
+		  __entry->ret, (unsigned long long) __entry->duration_ns)
+);
+
+#else /* VMW_HAS_TRACE_EVENTS */
+
+static inline void trace_vmw_execbuf(uint32_t cid, uint32_t bytes,
+				     uint32_t num_buffers, uint32_t seqno)
+{
+}
+
+static inline void trace_vmw_fifo_reserve(uint32_t bytes, uint32_t next_cmd,
+					  uint32_t stop, uint32_t min,
+					  uint32_t max, bool bounce)
+{
+}
+
+static inline void trace_vmw_fifo_commit(uint32_t bytes, bool bounce)
+{
+}
+
+static inline void trace_vmw_fence_send(uint32_t seqno, bool emulated)
+{
+}
+
+static inline void trace_vmw_fence_signaled(uint32_t seqno, pid_t pid,
+					    u64 latency_ns)
+{
+}
+
+static inline void trace_vmw_irq(uint32_t status, uint32_t seqno)
+{
+}
+
+static inline void trace_vmw_wait(enum vmw_wait_reason reason,
+				  uint32_t value, int ret, u64 duration_ns)
+{
+}
+
+#endif /* VMW_HAS_TRACE_EVENTS */
+
+#endif /* _VMWGFX_TRACE_H_ */
+
+#ifdef VMW_HAS_TRACE_EVENTS
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#include <trace/define_trace.h>
+#endif